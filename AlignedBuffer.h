@@ -0,0 +1,93 @@
+#ifndef STK_ALIGNEDBUFFER_H
+#define STK_ALIGNEDBUFFER_H
+
+#include <cstddef>
+#include <cstring>
+
+namespace stk {
+
+/**************************************************************************/
+/*! \class AlignedBuffer
+    \brief A zero-initialized array of plain data aligned to a cache line
+
+    Used to hold all of a reverb's delay lines in a single allocation.
+    Copies get their own aligned memory and keep the contents, so
+    objects holding an AlignedBuffer stay copyable.
+*/
+/***************************************************************************/
+
+template <typename T>
+class AlignedBuffer
+{
+    public:
+        //! alignment of the first element, in bytes
+        static const size_t alignment = 64;
+
+        //! allocate size zeroed elements
+        AlignedBuffer(size_t size = 0) : memory_(0), data_(0), size_(0) {
+            resize(size);
+        }
+
+        AlignedBuffer(const AlignedBuffer& other) : memory_(0), data_(0), size_(0) {
+            resize(other.size_);
+            if (size_) {
+                std::memcpy(data_, other.data_, size_ * sizeof(T));
+            }
+        }
+
+        AlignedBuffer& operator=(const AlignedBuffer& other) {
+            if (this != &other) {
+                if (size_ != other.size_) {
+                    resize(other.size_);
+                }
+                if (size_) {
+                    std::memcpy(data_, other.data_, size_ * sizeof(T));
+                }
+            }
+            return *this;
+        }
+
+        ~AlignedBuffer() {
+            delete [] memory_;
+        }
+
+        //! reallocate to size elements, all zeroed
+        void resize(size_t size) {
+            delete [] memory_;
+            memory_ = 0;
+            data_ = 0;
+            size_ = size;
+            if (size) {
+                memory_ = new char[size * sizeof(T) + alignment - 1];
+                size_t address = (size_t) memory_;
+                data_ = (T*) (memory_ + (alignment - address % alignment) % alignment);
+                clear();
+            }
+        }
+
+        //! zero every element
+        void clear() {
+            if (size_) {
+                std::memset(data_, 0, size_ * sizeof(T));
+            }
+        }
+
+        size_t size() const { return size_; }
+
+        T* data() { return data_; }
+
+        const T* data() const { return data_; }
+
+        T& operator[](size_t i) { return data_[i]; }
+
+        const T& operator[](size_t i) const { return data_[i]; }
+
+    private:
+        char* memory_;
+        T* data_;
+        size_t size_;
+};
+
+}
+
+#endif
@@ -15,104 +15,358 @@
 /***************************************************************************/
 
 #include "FreeVerb.h"
+#include "FreeVerbSimd.h"
+#include "FreeVerbLines.h"
 #include <math.h>
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
 
 using namespace stk;
 
 // set static delay line lengths
-int FreeVerb::cDelayLen[] = {1617, 1557, 1491, 1422, 1356, 1277, 1188, 1116};
-int FreeVerb::aDelayLen[] = {225, 556, 441, 341};
+template <typename T>
+const int BasicFreeVerb<T>::cDelayLen[] = {1617, 1557, 1491, 1422, 1356, 1277, 1188, 1116};
 
-FreeVerb::FreeVerb() {
+template <typename T>
+const int BasicFreeVerb<T>::aDelayLen[] = {225, 556, 441, 341};
+
+// delay line lengths at common sampling rates, floor(rate / 44100 * length)
+struct RateDelayLengths {
+    StkFloat rate;
+    int comb[FreeVerb::numCombs];
+    int allPass[FreeVerb::numAllPasses];
+};
+
+static constexpr RateDelayLengths rateDelayLengths[] = {
+    {  44100.0, {1617, 1557, 1491, 1422, 1356, 1277, 1188, 1116}, { 225,  556,  441,  341} },
+    {  48000.0, {1760, 1694, 1622, 1547, 1475, 1389, 1293, 1214}, { 244,  605,  480,  371} },
+    {  88200.0, {3234, 3114, 2982, 2844, 2712, 2554, 2376, 2232}, { 450, 1112,  882,  682} },
+    {  96000.0, {3520, 3389, 3245, 3095, 2951, 2779, 2586, 2429}, { 489, 1210,  960,  742} },
+    { 192000.0, {7040, 6778, 6491, 6191, 5903, 5559, 5172, 4858}, { 979, 2420, 1920, 1484} }
+};
+
+// offset added to the comb input by the DC_OFFSET strategy, far below
+// audibility but far above the denormal range of float, and how many
+// network frames apart, counted across calls so that a frame at a time
+// through tick() gets it no more often than a block does
+static const StkFloat denormalOffset = 1e-20;
+static const unsigned int denormalOffsetFrames = 64;
+
+// cutoff of the resampling filters as a fraction of the network's rate,
+// their transition band reaching to about half of it
+static const StkFloat resampleCutoff = 0.35;
+
+// a ONE_POLE ramp is complete once every value is this close to its target
+static const StkFloat rampSettled = 1e-6;
+
+// storage for the tuning constants, for when they are bound to a reference
+template <typename T>
+constexpr StkFloat BasicFreeVerb<T>::fixedGain;
+template <typename T>
+constexpr StkFloat BasicFreeVerb<T>::scaleWet;
+template <typename T>
+constexpr StkFloat BasicFreeVerb<T>::scaleDry;
+template <typename T>
+constexpr StkFloat BasicFreeVerb<T>::scaleDamp;
+template <typename T>
+constexpr StkFloat BasicFreeVerb<T>::scaleRoom;
+template <typename T>
+constexpr StkFloat BasicFreeVerb<T>::offsetRoom;
+
+template <typename T>
+BasicFreeVerb<T>::BasicFreeVerb() {
     // resize lastFrame_ for stereo output
     lastFrame_.resize(1, 2, 0.0);
 
-    // initialize parameters
-    this->setMix(0.75);            // set initially to 3/4 wet 1/4 dry signal (different than original freeverb) 
-    this->setRoomSize(0.75);       // feedback attenuation in LBFC
-    this->setDamp(0.25);           // pole of lowpass filters in the LBFC
-    this->setWidth(1.0);
-    this->setMode(false);
+    // initialize parameters, see Parameters for the defaults
+    this->setParameters(Parameters());
+    wetOnly_ = false;
+    this->setDenormals(FLUSH_TO_ZERO);
+    dcOffset_ = denormalOffset;
+    dcCountdown_ = 0;
+    smoothFrames_ = 0.0;
+    smoothing_ = LINEAR;
+    std::fill(rampStep_, rampStep_ + numRamps, 0.0);
+    rampLeft_ = 0;
 
     gain_ = fixedGain;      // input gain before sending to filters
     g_ = 0.5;               // allpass coefficient, immutable in FreeVerb
+    update();
 
-    // scale delay line lengths according to the current sampling rate
-    double fsScale = Stk::sampleRate() / 44100.0;
-    if (fsScale != 1.0) {
-        // scale comb filter delay lines
-        for (int i = 0; i < numCombs; i++) {
-            cDelayLen[i] = (int) floor(fsScale * cDelayLen[i]);
-        }
+    // full rate, delay lines for the current sampling rate
+    decimation_ = 1;
+    layoutDelayLines();
 
-        // scale allpass filter delay lines
-        for (int i = 0; i < numAllPasses; i++) {
-            aDelayLen[i] = (int) floor(fsScale * aDelayLen[i]);
-        }
+    bypassLevel_ = 0.0;
+    quietFrames_ = 0;
+    bypassed_ = false;
+    clips_[0] = 0;
+    clips_[1] = 0;
+}
+
+template <typename T>
+BasicFreeVerb<T>::~BasicFreeVerb() {}
+
+template <typename T>
+void BasicFreeVerb<T>::layoutDelayLines() {
+    // delay line lengths for the rate the network runs at, this instance's own
+    DelayLengths lengths = delayLengths(Stk::sampleRate() / decimation_);
+
+    // lay every delay line out in one arena, right channel lines next to their left partners
+    size_t arenaSize = 0;
+    for (int i = 0; i < numCombs; i++) {
+        arenaSize = placeDelayLine<T>(combDelayL_[i], lengths.comb[i], arenaSize);
+        arenaSize = placeDelayLine<T>(combDelayR_[i], lengths.comb[i] + stereoSpread, arenaSize);
+        combFilter_[i] = 0.0;
+        combFilter_[numCombs + i] = 0.0;
     }
+    for (int i = 0; i < numAllPasses; i++) {
+        arenaSize = placeDelayLine<T>(allPassDelayL_[i], lengths.allPass[i], arenaSize);
+        arenaSize = placeDelayLine<T>(allPassDelayR_[i], lengths.allPass[i] + stereoSpread, arenaSize);
+    }
+    arena_.resize(arenaSize);
 
-    // initialize delay lines for the LBFC filters
+    chunk_ = maxChunk;
     for (int i = 0; i < numCombs; i++) {
-        combDelayL_[i].setMaximumDelay(cDelayLen[i]);
-        combDelayL_[i].setDelay(cDelayLen[i]);
-        combDelayR_[i].setMaximumDelay(cDelayLen[i] + stereoSpread);
-        combDelayR_[i].setDelay(cDelayLen[i] + stereoSpread);
+        chunk_ = std::min(chunk_, (size_t) combDelayL_[i].length);
+    }
+    for (int i = 0; i < numAllPasses; i++) {
+        chunk_ = std::min(chunk_, (size_t) allPassDelayL_[i].length);
     }
+    chunk_ = std::max(chunk_, (size_t) 1);
 
-    // initialize delay lines for the allpass filters
+    // once this long passes quietly, every sample in the network came from quiet input
+    quietFramesNeeded_ = 0;
+    for (int i = 0; i < numCombs; i++) {
+        quietFramesNeeded_ = std::max(quietFramesNeeded_, (unsigned long) combDelayR_[i].length);
+    }
     for (int i = 0; i < numAllPasses; i++) {
-        allPassDelayL_[i].setMaximumDelay(aDelayLen[i]);
-        allPassDelayL_[i].setDelay(aDelayLen[i]);
-        allPassDelayR_[i].setMaximumDelay(aDelayLen[i] + stereoSpread);
-        allPassDelayR_[i].setDelay(aDelayLen[i] + stereoSpread);
+        quietFramesNeeded_ += allPassDelayR_[i].length;
     }
+    quietFramesNeeded_ = (quietFramesNeeded_ + resampleTaps) * decimation_;
+    quietFrames_ = 0;
+
+    clearLines();
 }
 
-FreeVerb::~FreeVerb() {}
+template <typename T>
+void BasicFreeVerb<T>::setDecimation(unsigned int factor) {
+    if (factor != 1 && factor != 2 && factor != 4) {
+        oStream_ << "FreeVerb::setDecimation: factor must be 1, 2 or 4 ... setting to 1!";
+        handleError(StkError::WARNING);
+        factor = 1;
+    }
+    if (factor == decimation_) {
+        return;
+    }
+
+    decimation_ = factor;
+    layoutDelayLines();
+
+    // windowed sinc lowpass for both resampling filters, cut off below the
+    // network's Nyquist frequency so little folds back around it
+    const int taps = resampleTaps * decimation_;
+    const StkFloat cutoff = resampleCutoff / decimation_;
+    const StkFloat centre = (taps - 1) / 2.0;
+    StkFloat sum = 0.0;
+    StkFloat h[maxDecimation * resampleTaps];
+    for (int k = 0; k < taps; k++) {
+        StkFloat x = k - centre;
+        StkFloat sinc = (x == 0.0) ? 2.0 * cutoff : sin(TWO_PI * cutoff * x) / (PI * x);
+        StkFloat window = 0.42 - 0.5 * cos(TWO_PI * k / (taps - 1)) + 0.08 * cos(2.0 * TWO_PI * k / (taps - 1));
+        h[k] = sinc * window;
+        sum += h[k];
+    }
+
+    // unity gain through the decimator; the interpolator makes up for the
+    // zeros it would otherwise stuff between network samples and is kept
+    // as one set of taps for each frame after a network sample. Both are
+    // stored oldest sample first, so they run forwards over their input
+    for (int k = 0; k < taps; k++) {
+        decimateFilter_[k] = (T) (h[taps - 1 - k] / sum);
+    }
+    for (int p = 0; p < (int) decimation_; p++) {
+        for (int l = 0; l < resampleTaps; l++) {
+            interpolateFilter_[p * resampleTaps + l] = (T) (h[(resampleTaps - 1 - l) * decimation_ + p] * decimation_ / sum);
+        }
+    }
+}
+
+template <typename T>
+unsigned int BasicFreeVerb<T>::getDecimation() {
+    return decimation_;
+}
+
+template <typename T>
+typename BasicFreeVerb<T>::DelayLengths BasicFreeVerb<T>::delayLengths(StkFloat rate) {
+    DelayLengths lengths;
+    for (size_t r = 0; r < sizeof(rateDelayLengths) / sizeof(rateDelayLengths[0]); r++) {
+        if (rateDelayLengths[r].rate == rate) {
+            std::copy(rateDelayLengths[r].comb, rateDelayLengths[r].comb + numCombs, lengths.comb);
+            std::copy(rateDelayLengths[r].allPass, rateDelayLengths[r].allPass + numAllPasses, lengths.allPass);
+            return lengths;
+        }
+    }
+
+    // scale delay line lengths according to the sampling rate
+    double fsScale = rate / 44100.0;
+    for (int i = 0; i < numCombs; i++) {
+        lengths.comb[i] = (int) floor(fsScale * cDelayLen[i]);
+    }
+    for (int i = 0; i < numAllPasses; i++) {
+        lengths.allPass[i] = (int) floor(fsScale * aDelayLen[i]);
+    }
+
+    return lengths;
+}
 
-void FreeVerb::setMix(StkFloat value) {
+template <typename T>
+void BasicFreeVerb<T>::setMix(StkFloat value) {
     this->setEffectMix(value);
-    update();    
+    dirty_ = true;
 }
 
-void FreeVerb::setRoomSize(StkFloat roomSize) {
+template <typename T>
+void BasicFreeVerb<T>::setRoomSize(StkFloat roomSize) {
     roomSizeMem_ = (roomSize * scaleRoom) + offsetRoom;
-    update();
+    dirty_ = true;
 }
 
-StkFloat FreeVerb::getRoomSize() {
+template <typename T>
+StkFloat BasicFreeVerb<T>::getRoomSize() {
     return (roomSizeMem_ - offsetRoom) / scaleRoom;
 }
 
-void FreeVerb::setDamp(StkFloat damping) {
+template <typename T>
+void BasicFreeVerb<T>::setDamp(StkFloat damping) {
     dampMem_ = damping * scaleDamp;
-    update();
+    dirty_ = true;
 }
 
-StkFloat FreeVerb::getDamp() {
+template <typename T>
+StkFloat BasicFreeVerb<T>::getDamp() {
     return dampMem_ / scaleDamp;
 }
 
-void FreeVerb::setWidth(StkFloat width) {
+template <typename T>
+void BasicFreeVerb<T>::setWidth(StkFloat width) {
     width_ = width;
-    update();
+    dirty_ = true;
 }
 
-StkFloat FreeVerb::getWidth() {
+template <typename T>
+StkFloat BasicFreeVerb<T>::getWidth() {
     return width_;
 }
 
-void FreeVerb::setMode(bool isFrozen) {
+template <typename T>
+void BasicFreeVerb<T>::setMode(bool isFrozen) {
     frozenMode_ = isFrozen;
-    update();
+    dirty_ = true;
 }
 
-StkFloat FreeVerb::getMode() {
+template <typename T>
+StkFloat BasicFreeVerb<T>::getMode() {
     return frozenMode_;
 }
 
-void FreeVerb::update() {
+template <typename T>
+void BasicFreeVerb<T>::setParameters(const Parameters& parameters) {
+    this->setEffectMix(parameters.mix);
+    roomSizeMem_ = (parameters.roomSize * scaleRoom) + offsetRoom;
+    dampMem_ = parameters.damp * scaleDamp;
+    width_ = parameters.width;
+    frozenMode_ = parameters.frozen;
+    dirty_ = true;
+}
+
+template <typename T>
+typename BasicFreeVerb<T>::Parameters BasicFreeVerb<T>::getParameters() {
+    Parameters parameters;
+    parameters.mix = effectMix_;
+    parameters.roomSize = getRoomSize();
+    parameters.damp = getDamp();
+    parameters.width = width_;
+    parameters.frozen = frozenMode_;
+    return parameters;
+}
+
+template <typename T>
+void BasicFreeVerb<T>::setWetOnly(bool wetOnly) {
+    wetOnly_ = wetOnly;
+}
+
+template <typename T>
+void BasicFreeVerb<T>::setDenormals(Denormals denormals) {
+    if (denormals == FLUSH_TO_ZERO && !FreeVerbSimd::canFlushDenormals()) {
+        denormals = DC_OFFSET;
+    }
+    denormals_ = denormals;
+}
+
+template <typename T>
+typename BasicFreeVerb<T>::Denormals BasicFreeVerb<T>::getDenormals() {
+    return denormals_;
+}
+
+template <typename T>
+void BasicFreeVerb<T>::setBypassLevel(StkFloat level) {
+    bypassLevel_ = std::max(level, 0.0);
+    quietFrames_ = 0;
+    bypassed_ = false;
+}
+
+template <typename T>
+bool BasicFreeVerb<T>::isBypassed() {
+    return bypassed_;
+}
+
+template <typename T>
+unsigned long BasicFreeVerb<T>::getClipCount(unsigned int channel) {
+    return clips_[channel];
+}
+
+template <typename T>
+void BasicFreeVerb<T>::resetClipCounts() {
+    clips_[0] = 0;
+    clips_[1] = 0;
+}
+
+template <typename T>
+void BasicFreeVerb<T>::setSmoothing(StkFloat time, Smoothing shape) {
+    smoothFrames_ = std::max(time, 0.0) * Stk::sampleRate();
+    smoothing_ = shape;
+}
+
+template <typename T>
+unsigned long BasicFreeVerb<T>::tailFrames(StkFloat level) {
+    if (dirty_) {
+        update();
+    }
+    if (frozenMode_ || roomSize_ >= 1.0) {
+        return (unsigned long) -1;
+    }
+
+    // every pass around a comb loses at least 1 - roomSize_, the damping only adds to it
+    StkFloat combPasses = ceil(log(level) / log(roomSize_));
+    StkFloat allPassPasses = ceil(log(level) / log(g_));
+
+    unsigned int longestComb = 0;
+    for (int i = 0; i < numCombs; i++) {
+        longestComb = std::max(longestComb, combDelayR_[i].length);
+    }
+    StkFloat frames = combPasses * longestComb;
+    for (int i = 0; i < numAllPasses; i++) {
+        frames += allPassPasses * allPassDelayR_[i].length;
+    }
+
+    return (unsigned long) (frames * decimation_);
+}
+
+template <typename T>
+void BasicFreeVerb<T>::update() {
     StkFloat wet = scaleWet * effectMix_;
     dry_ = scaleDry * (1.0-effectMix_);
 
@@ -136,114 +390,370 @@ void FreeVerb::update() {
         gain_ = fixedGain;
     }
 
-    for (int i = 0; i < numCombs; i++) {
-        // set low pass filter for delay output
-        combFilterL_[i].setCoefficients(1.0 - damp_, -damp_);
-        combFilterR_[i].setCoefficients(1.0 - damp_, -damp_);
+    // set low pass filter for delay output
+    damp1_ = damp_;
+    damp2_ = 1.0 - damp_;
+
+    // glide from the values in use to the new ones, or jump straight there
+    const StkFloat target[numRamps] = { roomSize_, damp_, wet1_, wet2_, dry_ };
+    ramping_ = smoothFrames_ >= 1.0;
+    rampLeft_ = (unsigned long) smoothFrames_;
+    for (int i = 0; i < numRamps; i++) {
+        if (ramping_) {
+            rampStep_[i] = (target[i] - ramp_[i]) / rampLeft_;
+        }
+        else {
+            ramp_[i] = target[i];
+        }
     }
+
+    dirty_ = false;
 }
 
-void FreeVerb::clear() {
-    // clear LBFC delay lines
-    for (int i = 0; i < numCombs; i++) {
-        combDelayL_[i].clear();
-        combDelayR_[i].clear();
+template <typename T>
+void BasicFreeVerb<T>::advanceRamps(size_t frames) {
+    if (!ramping_) {
+        return;
     }
 
-    // clear allpass delay lines
-    for (int i = 0; i < numAllPasses; i++) {
-        allPassDelayL_[i].clear();
-        allPassDelayR_[i].clear();
+    if (smoothing_ == LINEAR) {
+        if (rampLeft_ > frames) {
+            for (int i = 0; i < numRamps; i++) {
+                ramp_[i] += rampStep_[i] * frames;
+            }
+            rampLeft_ -= frames;
+            return;
+        }
+    }
+    else {
+        // the one pole response over the whole run
+        const StkFloat target[numRamps] = { roomSize_, damp_, wet1_, wet2_, dry_ };
+        StkFloat pole = exp(-(StkFloat) frames / smoothFrames_);
+        bool settled = true;
+        for (int i = 0; i < numRamps; i++) {
+            ramp_[i] = target[i] + (ramp_[i] - target[i]) * pole;
+            settled = settled && fabs(ramp_[i] - target[i]) < rampSettled;
+        }
+        if (!settled) {
+            return;
+        }
+    }
+
+    finishRamps();
+}
+
+template <typename T>
+void BasicFreeVerb<T>::finishRamps() {
+    ramp_[rampRoomSize] = roomSize_;
+    ramp_[rampDamp] = damp_;
+    ramp_[rampWet1] = wet1_;
+    ramp_[rampWet2] = wet2_;
+    ramp_[rampDry] = dry_;
+    ramping_ = false;
+}
+
+template <typename T>
+void BasicFreeVerb<T>::clear() {
+    clearLines();
+    dcOffset_ = denormalOffset;
+    dcCountdown_ = 0;
+    quietFrames_ = 0;
+    bypassed_ = false;
+
+    // a cleared reverb starts on its parameters rather than gliding to them,
+    // including any set since the last block
+    if (dirty_) {
+        update();
     }
+    finishRamps();
 
     lastFrame_[0] = 0.0;
     lastFrame_[1] = 0.0;
 }
 
-StkFloat FreeVerb::lastOut(unsigned int channel) {
-#if defined(_STK_DEBUG_)
-    if (channel > 1) {
-        oStream_ << "FreeVerb::lastOut(): channel argument must be less than 2!";
-        handleError(StkError::FUNCTION_ARGUMENT);
+template <typename T>
+void BasicFreeVerb<T>::clearLines() {
+    // rewind every delay line, so a cleared reverb splits its work exactly
+    // as a new one does, and leave the old samples to be zeroed as the
+    // lines come round to them rather than all at once
+    for (int i = 0; i < numCombs; i++) {
+        combDelayL_[i].index = 0;
+        combDelayL_[i].stale = true;
+        combDelayR_[i].index = 0;
+        combDelayR_[i].stale = true;
+    }
+    for (int i = 0; i < numAllPasses; i++) {
+        allPassDelayL_[i].index = 0;
+        allPassDelayL_[i].stale = true;
+        allPassDelayR_[i].index = 0;
+        allPassDelayR_[i].stale = true;
     }
-#endif
 
-    return lastFrame_[channel];
+    // clear LBFC lowpass states
+    for (int i = 0; i < 2 * numCombs; i++) {
+        combFilter_[i] = 0.0;
+    }
+
+    // and the resampling filters
+    std::fill(decimateHistory_, decimateHistory_ + maxDecimation * resampleTaps, T(0));
+    std::fill(interpolateHistory_, interpolateHistory_ + 2 * resampleTaps, T(0));
+    resamplePhase_ = 0;
 }
 
-StkFloat FreeVerb::tick(StkFloat inputL, StkFloat inputR, unsigned int channel) {
-#if defined(_STK_DEBUG_)
-    if (channel > 1) {
-        oStream_ << "FreeVerb::tick(): channel argument must be less than 2!";
-        handleError(StkError::FUNCTION_ARGUMENT);
+// what a snapshot starts with, all checked before anything is restored
+struct SnapshotHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sampleBytes;   // sizeof(T) of the reverb that wrote it
+    uint32_t decimation;
+    uint32_t lengths[2 * (FreeVerb::numCombs + FreeVerb::numAllPasses)];
+    uint64_t size;          // bytes in the whole snapshot
+};
+
+static const uint32_t snapshotMagic = 0x46565354;   // "FVST"
+
+// visitors for visitState(): count, write or read every field in turn
+struct SnapshotSizer {
+    size_t size;
+    template <typename X>
+    void operator()(X* x, size_t count = 1) {
+        size += count * sizeof(X);
     }
-#endif
+};
 
-    if (!inputR) {
-        inputR = inputL;
+struct SnapshotWriter {
+    char* p;
+    template <typename X>
+    void operator()(X* x, size_t count = 1) {
+        std::memcpy(p, x, count * sizeof(X));
+        p += count * sizeof(X);
     }
+};
 
-    // gain
-    StkFloat fInput = (inputL + inputR) * gain_;
+struct SnapshotReader {
+    const char* p;
+    template <typename X>
+    void operator()(X* x, size_t count = 1) {
+        std::memcpy(x, p, count * sizeof(X));
+        p += count * sizeof(X);
+    }
+};
 
-    StkFloat outL = 0.0;
-    StkFloat outR = 0.0;
+template <typename T>
+template <typename Visitor>
+void BasicFreeVerb<T>::visitState(Visitor& visit) {
+    // parameters, and what update() made of them
+    visit(&effectMix_);
+    visit(&g_);
+    visit(&gain_);
+    visit(&roomSizeMem_);
+    visit(&roomSize_);
+    visit(&dampMem_);
+    visit(&damp_);
+    visit(&damp1_);
+    visit(&damp2_);
+    visit(&wet1_);
+    visit(&wet2_);
+    visit(&dry_);
+    visit(&width_);
+    visit(&frozenMode_);
+    visit(&wetOnly_);
+    visit(&dirty_);
+    visit(&denormals_);
+    visit(&dcOffset_);
+    visit(&dcCountdown_);
 
-    // 8 LBCF filters in parallel
-    for (int i = 0; i < numCombs; i++) {
-        // process L channel
-        StkFloat yn = fInput + (roomSize_ * FreeVerb::undenormalize(combFilterL_[i].tick(FreeVerb::undenormalize(combDelayL_[i].nextOut()))));
-        combDelayL_[i].tick(yn);
-        outL += yn;
+    // smoothing, bypass and the limiter
+    visit(ramp_, numRamps);
+    visit(rampStep_, numRamps);
+    visit(&rampLeft_);
+    visit(&ramping_);
+    visit(&smoothFrames_);
+    visit(&smoothing_);
+    visit(&bypassLevel_);
+    visit(&quietFrames_);
+    visit(&bypassed_);
+    visit(clips_, 2);
+    visit(&lastFrame_[0], 2);
 
-        // process R channel
-        yn = fInput + (roomSize_ * FreeVerb::undenormalize(combFilterR_[i].tick(FreeVerb::undenormalize(combDelayR_[i].nextOut()))));
-        combDelayR_[i].tick(yn);
-        outR += yn;
+    // the network
+    visit(combFilter_, 2 * numCombs);
+    DelayLine *lines[] = { combDelayL_, combDelayR_, allPassDelayL_, allPassDelayR_ };
+    const int counts[] = { numCombs, numCombs, numAllPasses, numAllPasses };
+    for (int k = 0; k < 4; k++) {
+        for (int i = 0; i < counts[k]; i++) {
+            visit(&lines[k][i].index);
+            visit(arena_.data() + lines[k][i].offset, lines[k][i].length);
+        }
     }
 
-    // 4 allpass filters in series
+    // economy mode
+    visit(&resamplePhase_);
+    visit(decimateHistory_, maxDecimation * resampleTaps);
+    visit(interpolateHistory_, 2 * resampleTaps);
+}
+
+template <typename T>
+size_t BasicFreeVerb<T>::snapshotSize() {
+    SnapshotSizer sizer = { sizeof(SnapshotHeader) };
+    visitState(sizer);
+    return sizer.size;
+}
+
+template <typename T>
+size_t BasicFreeVerb<T>::snapshot(void* buffer, size_t size) {
+    const size_t needed = snapshotSize();
+    if (size < needed) {
+        return 0;
+    }
+
+    SnapshotHeader header;
+    header.magic = snapshotMagic;
+    header.version = snapshotVersion;
+    header.sampleBytes = sizeof(T);
+    header.decimation = decimation_;
+    for (int i = 0; i < numCombs; i++) {
+        header.lengths[i] = combDelayL_[i].length;
+        header.lengths[numCombs + i] = combDelayR_[i].length;
+    }
     for (int i = 0; i < numAllPasses; i++) {
-        // process L channel
-        StkFloat vn_m = FreeVerb::undenormalize(allPassDelayL_[i].nextOut());
-        StkFloat vn = outL + (g_ * vn_m);
-        allPassDelayL_[i].tick(vn);
-        
-        // calculate output
-        outL = -vn + (1.0 + g_)*vn_m;
+        header.lengths[2 * numCombs + i] = allPassDelayL_[i].length;
+        header.lengths[2 * numCombs + numAllPasses + i] = allPassDelayR_[i].length;
+    }
+    header.size = needed;
+    std::memcpy(buffer, &header, sizeof(header));
+
+    // the snapshot holds silence, not old samples, for what clear() left
+    settleLines();
+
+    SnapshotWriter writer = { (char *) buffer + sizeof(header) };
+    visitState(writer);
+    return needed;
+}
 
-        // process R channel
-        vn_m = FreeVerb::undenormalize(allPassDelayR_[i].nextOut());
-        vn = outR + (g_ * vn_m);
-        allPassDelayR_[i].tick(vn);
+template <typename T>
+bool BasicFreeVerb<T>::restore(const void* buffer, size_t size) {
+    SnapshotHeader header;
+    if (size < sizeof(header)) {
+        oStream_ << "FreeVerb::restore: buffer too small for a snapshot!";
+        handleError(StkError::WARNING);
+        return false;
+    }
+    std::memcpy(&header, buffer, sizeof(header));
+    if (header.magic != snapshotMagic || header.version != snapshotVersion || header.sampleBytes != sizeof(T)) {
+        oStream_ << "FreeVerb::restore: not a snapshot of this version and sample type!";
+        handleError(StkError::WARNING);
+        return false;
+    }
 
-        // calculate output
-        outR = -vn + (1.0 + g_)*vn_m;
+    // the delay lines this reverb has, or would have at the snapshot's decimation
+    DelayLengths lengths = delayLengths(Stk::sampleRate() / header.decimation);
+    bool fits = (header.decimation == 1 || header.decimation == 2 || header.decimation == 4);
+    for (int i = 0; i < numCombs; i++) {
+        unsigned int length = (header.decimation == decimation_) ? combDelayL_[i].length : lengths.comb[i];
+        fits &= header.lengths[i] == length;
+        fits &= header.lengths[numCombs + i] == length + stereoSpread;
+    }
+    for (int i = 0; i < numAllPasses; i++) {
+        unsigned int length = (header.decimation == decimation_) ? allPassDelayL_[i].length : lengths.allPass[i];
+        fits &= header.lengths[2 * numCombs + i] == length;
+        fits &= header.lengths[2 * numCombs + numAllPasses + i] == length + stereoSpread;
+    }
+    if (!fits) {
+        oStream_ << "FreeVerb::restore: snapshot delay lines do not match this reverb's!";
+        handleError(StkError::WARNING);
+        return false;
     }
 
-    // mix output
-    lastFrame_[0] = outL*wet1_ + outR*wet2_ + inputL*dry_;
-    lastFrame_[1] = outR*wet1_ + outL*wet2_ + inputR*dry_;
+    // the snapshot's size with its own delay lines in place of this reverb's
+    size_t expected = snapshotSize();
+    for (int i = 0; i < 2 * (numCombs + numAllPasses); i++) {
+        expected += header.lengths[i] * sizeof(T);
+    }
+    for (int i = 0; i < numCombs; i++) {
+        expected -= (combDelayL_[i].length + combDelayR_[i].length) * sizeof(T);
+    }
+    for (int i = 0; i < numAllPasses; i++) {
+        expected -= (allPassDelayL_[i].length + allPassDelayR_[i].length) * sizeof(T);
+    }
+    if (header.size != expected || size < expected) {
+        oStream_ << "FreeVerb::restore: snapshot is truncated!";
+        handleError(StkError::WARNING);
+        return false;
+    }
+
+    setDecimation(header.decimation);
+    SnapshotReader reader = { (const char *) buffer + sizeof(header) };
+    visitState(reader);
 
-    // hard limiter
-    // there's not much else we can do at this point
-    if (lastFrame_[0] >= 1.0) {
-        lastFrame_[0] = 0.9999;
+    // every line came in whole
+    DelayLine *lines[] = { combDelayL_, combDelayR_, allPassDelayL_, allPassDelayR_ };
+    const int counts[] = { numCombs, numCombs, numAllPasses, numAllPasses };
+    for (int k = 0; k < 4; k++) {
+        for (int i = 0; i < counts[k]; i++) {
+            lines[k][i].stale = false;
+        }
     }
-    if (lastFrame_[0] <= -1.0) {
-        lastFrame_[0] = -0.9999;
+    return true;
+}
+
+template <typename T>
+BasicFreeVerb<T>* BasicFreeVerb<T>::clone() {
+    return new BasicFreeVerb<T>(*this);
+}
+
+template <typename T>
+void BasicFreeVerb<T>::settleLines() {
+    DelayLine *lines[] = { combDelayL_, combDelayR_, allPassDelayL_, allPassDelayR_ };
+    const int counts[] = { numCombs, numCombs, numAllPasses, numAllPasses };
+    for (int k = 0; k < 4; k++) {
+        for (int i = 0; i < counts[k]; i++) {
+            DelayLine &line = lines[k][i];
+            if (line.stale) {
+                T *ring = arena_.data() + line.offset;
+                std::fill(ring + line.index, ring + line.length, T(0));
+                line.stale = false;
+            }
+        }
     }
-    if (lastFrame_[1] >= 1.0) {
-        lastFrame_[1] = 0.9999;
+}
+
+template <typename T>
+StkFloat BasicFreeVerb<T>::lastOut(unsigned int channel) {
+#if defined(_STK_DEBUG_)
+    if (channel > 1) {
+        oStream_ << "FreeVerb::lastOut(): channel argument must be less than 2!";
+        handleError(StkError::FUNCTION_ARGUMENT);
     }
-    if (lastFrame_[1] <= -1.0) {
-        lastFrame_[1] = -0.9999;
+#endif
+
+    return lastFrame_[channel];
+}
+
+template <typename T>
+StkFloat BasicFreeVerb<T>::tick(StkFloat input) {
+    StkFloat outputR;
+    processBlock(&input, (StkFloat *) NULL, 1, &input, &outputR, 1, 1);
+
+    return lastFrame_[0];
+}
+
+template <typename T>
+StkFloat BasicFreeVerb<T>::tick(StkFloat inputL, StkFloat inputR, unsigned int channel) {
+#if defined(_STK_DEBUG_)
+    if (channel > 1) {
+        oStream_ << "FreeVerb::tick(): channel argument must be less than 2!";
+        handleError(StkError::FUNCTION_ARGUMENT);
     }
+#endif
+
+    processBlock(&inputL, &inputR, 1, &inputL, &inputR, 1, 1);
 
     return lastFrame_[channel];
 }
 
-StkFrames& FreeVerb::tick(StkFrames& frames) {
+template <typename T>
+StkFrames& BasicFreeVerb<T>::tick(StkFrames& frames) {
     unsigned int numChannels = frames.channels();
 
 #if defined(_STK_DEBUG_)
@@ -254,21 +764,19 @@ StkFrames& FreeVerb::tick(StkFrames& frames) {
 #endif
 
     StkFloat *samples = &frames[0];
-    for (unsigned int i = 0; i < frames.frames(); i++, samples += numChannels) {
-        // if frames is stereo
-        if (numChannels == 2) {
-            *samples = tick(*samples, *(samples+1));
-            *(samples+1) = lastFrame_[1];
-        }
-        else {
-            *samples = tick(*samples);
-        }
+    // if frames is stereo
+    if (numChannels == 2) {
+        processBlock(samples, samples+1, 2, samples, samples+1, 2, frames.frames());
+    }
+    else {
+        processBlock(samples, (StkFloat *) NULL, numChannels, samples, (StkFloat *) NULL, numChannels, frames.frames());
     }
 
     return frames;
 }
 
-StkFrames& FreeVerb::tick(StkFrames& iFrames, StkFrames &oFrames) {
+template <typename T>
+StkFrames& BasicFreeVerb<T>::tick(StkFrames& iFrames, StkFrames &oFrames) {
     unsigned int iNumChannels = iFrames.channels();
     unsigned int oNumChannels = oFrames.channels();
 
@@ -281,20 +789,561 @@ StkFrames& FreeVerb::tick(StkFrames& iFrames, StkFrames &oFrames) {
 
     StkFloat *iSamples = &iFrames[0];
     StkFloat *oSamples = &oFrames[0];
-    for (unsigned int i = 0; i < iFrames.frames(); i++, iSamples += iNumChannels, oSamples += oNumChannels) {
-        // if iFrames is stereo
-        if (iNumChannels == 2) {
-            *oSamples = tick(*iSamples, *(iSamples+1));
+    // mono input is sent to both channels, mono output keeps the left channel
+    processBlock(iSamples, (iNumChannels == 2) ? iSamples+1 : (StkFloat *) NULL, iNumChannels,
+                 oSamples, (oNumChannels == 2) ? oSamples+1 : (StkFloat *) NULL, oNumChannels,
+                 iFrames.frames());
+
+    return oFrames;
+}
+
+template <typename T>
+StkFrames& BasicFreeVerb<T>::mixDry(const StkFrames& iFrames, StkFrames& oFrames) {
+    unsigned int iNumChannels = iFrames.channels();
+    unsigned int oNumChannels = oFrames.channels();
+    if (dirty_) {
+        update();
+    }
+
+#if defined(_STK_DEBUG_)
+    if (iNumChannels > 2 || oNumChannels > 2) {
+        oStream_ << "FreeVerb::mixDry(): must be <= 2 channels!";
+        handleError(StkError::FUNCTION_ARGUMENT);
+    }
+#endif
+
+    // mono input is sent to both channels, as in tick()
+    unsigned int iRight = (iNumChannels == 2) ? 1 : 0;
+    for (unsigned int t = 0; t < oFrames.frames(); t++) {
+        for (unsigned int c = 0; c < oNumChannels; c++) {
+            StkFloat input = iFrames[t * iNumChannels + (c ? iRight : 0)];
+            StkFloat y = oFrames[t * oNumChannels + c] + input*dry_;
+            clips_[c] += (y >= 1.0) | (y <= -1.0);
+            oFrames[t * oNumChannels + c] = limit(y);
+        }
+    }
+
+    return oFrames;
+}
+
+template <typename T>
+void BasicFreeVerb<T>::process(const float* inL, const float* inR, float* outL, float* outR, size_t n) {
+    processBlock(inL, inR, 1, outL, outR, 1, n);
+}
+
+template <typename T>
+void BasicFreeVerb<T>::process(const StkFloat* inL, const StkFloat* inR, StkFloat* outL, StkFloat* outR, size_t n) {
+    processBlock(inL, inR, 1, outL, outR, 1, n);
+}
+
+template <typename T>
+void BasicFreeVerb<T>::processInterleaved(const float* in, unsigned int inChannels,
+                                          float* out, unsigned int outChannels, size_t n) {
+    processBlock(in, inChannels > 1 ? in + 1 : NULL, inChannels,
+                 out, outChannels > 1 ? out + 1 : NULL, outChannels, n);
+}
+
+template <typename T>
+void BasicFreeVerb<T>::processInterleaved(const StkFloat* in, unsigned int inChannels,
+                                          StkFloat* out, unsigned int outChannels, size_t n) {
+    processBlock(in, inChannels > 1 ? in + 1 : NULL, inChannels,
+                 out, outChannels > 1 ? out + 1 : NULL, outChannels, n);
+}
+
+template <typename T>
+void BasicFreeVerb<T>::processSends(const Send<float>* sends, unsigned int numSends,
+                                    float* outL, float* outR, size_t n) {
+    processSendsBlock(sends, numSends, outL, outR, n);
+}
+
+template <typename T>
+void BasicFreeVerb<T>::processSends(const Send<StkFloat>* sends, unsigned int numSends,
+                                    StkFloat* outL, StkFloat* outR, size_t n) {
+    processSendsBlock(sends, numSends, outL, outR, n);
+}
+
+template <typename T>
+template <typename Sample>
+void BasicFreeVerb<T>::processSendsBlock(const Send<Sample>* sends, unsigned int numSends,
+                                         Sample* outL, Sample* outR, size_t n) {
+    // the return is wet-only whatever the reverb is set to
+    const bool wetOnly = wetOnly_;
+    wetOnly_ = true;
+
+    // the bus is mono input to processBlock(), which doubles it as it does
+    // a mono source, so stereo sources go in at half their channels' sum
+    Sample bus[maxChunk * maxDecimation];
+    size_t done = 0;
+    while (done < n) {
+        size_t frames = std::min(n - done, (size_t) (maxChunk * maxDecimation));
+        if (numSends == 0) {
+            std::fill(bus, bus + frames, Sample(0));
+        }
+        for (unsigned int s = 0; s < numSends; s++) {
+            const Sample *l = sends[s].left + done;
+            const StkFloat gain = sends[s].right ? 0.5 * sends[s].gain : sends[s].gain;
+            if (sends[s].right) {
+                const Sample *r = sends[s].right + done;
+                for (size_t t = 0; t < frames; t++) {
+                    StkFloat x = ((StkFloat) l[t] + (StkFloat) r[t]) * gain;
+                    bus[t] = (Sample) (s ? bus[t] + x : x);
+                }
+            }
+            else {
+                for (size_t t = 0; t < frames; t++) {
+                    StkFloat x = (StkFloat) l[t] * gain;
+                    bus[t] = (Sample) (s ? bus[t] + x : x);
+                }
+            }
+        }
+
+        processBlock(bus, (const Sample *) NULL, 1, outL + done, outR ? outR + done : NULL, 1, frames);
+        done += frames;
+    }
+
+    wetOnly_ = wetOnly;
+}
+
+// run frames samples through one allpass filter and advance its delay line
+template <typename T>
+static inline void allPassDelay(T* x, T* ring, typename BasicFreeVerb<T>::DelayLine& line,
+                                size_t frames, T g, bool undenormalize) {
+    size_t run = std::min(frames, (size_t) (line.length - line.index));
+    if (line.stale) {
+        std::fill(ring + line.index, ring + line.index + run, T(0));
+    }
+    FreeVerbSimd::allPass(x, ring + line.index, run, g, undenormalize);
+    if (run < frames) {
+        FreeVerbSimd::allPass(x + run, ring, frames - run, g, undenormalize);
+    }
+
+    advanceDelay(line, frames);
+}
+
+// one step of a comb for networkFrame(), returning its output
+template <bool U, typename T>
+static inline T combFrame(T* arena, typename BasicFreeVerb<T>::DelayLine& line, T& state, T input,
+                          T roomSize, T damp1, T damp2) {
+    T *slot = arena + line.offset + line.index;
+    T x = line.stale ? T(0) : *slot;
+    state = damp2 * (U ? BasicFreeVerb<T>::undenormalize(x) : x) + damp1 * state;
+    T y = input + (roomSize * (U ? BasicFreeVerb<T>::undenormalize(state) : state));
+    *slot = y;
+    if (++line.index == line.length) {
+        line.index = 0;
+        line.stale = false;
+    }
+    return y;
+}
+
+// one step of an allpass for networkFrame(), returning its output
+template <bool U, typename T>
+static inline T allPassFrame(T* arena, typename BasicFreeVerb<T>::DelayLine& line, T x, T g, T gOut) {
+    T *slot = arena + line.offset + line.index;
+    T vn_m = line.stale ? T(0) : *slot;
+    if (U) {
+        vn_m = BasicFreeVerb<T>::undenormalize(vn_m);
+    }
+    T vn = x + (g * vn_m);
+    *slot = vn;
+    if (++line.index == line.length) {
+        line.index = 0;
+        line.stale = false;
+    }
+    return -vn + gOut*vn_m;
+}
+
+template <typename T>
+template <bool U>
+void BasicFreeVerb<T>::networkFrame(T input, T* combs, T* wetL, T* wetR, T roomSize, T damp1, T damp2) {
+    // both channels go side by side, so their filters overlap
+    T *arena = arena_.data();
+    T sumL = 0, sumR = 0;
+    for (int i = 0; i < numCombs; i++) {
+        combs[i] = combFrame<U>(arena, combDelayL_[i], combFilter_[i], input, roomSize, damp1, damp2);
+        combs[numCombs + i] = combFrame<U>(arena, combDelayR_[i], combFilter_[numCombs + i], input,
+                                           roomSize, damp1, damp2);
+        sumL += combs[i];
+        sumR += combs[numCombs + i];
+    }
+
+    const T g = (T) g_, gOut = 1 + g;
+    for (int i = 0; i < numAllPasses; i++) {
+        sumL = allPassFrame<U>(arena, allPassDelayL_[i], sumL, g, gOut);
+        sumR = allPassFrame<U>(arena, allPassDelayR_[i], sumR, g, gOut);
+    }
+    wetL[0] = sumL;
+    wetR[0] = sumR;
+}
+
+template <typename T>
+template <typename Sample>
+size_t BasicFreeVerb<T>::decimate(const Sample* inL, const Sample* inR, unsigned int inStride,
+                                  size_t frames, T* output) {
+    // the filter's history followed by the new input, newest last
+    const size_t taps = resampleTaps * decimation_;
+    const size_t history = taps - 1;
+    T x[maxDecimation * resampleTaps + maxDecimation * maxChunk];
+    std::copy(decimateHistory_, decimateHistory_ + history, x);
+    for (size_t t = 0; t < frames; t++, inL += inStride, inR += inStride) {
+        x[history + t] = (T) (((StkFloat) *inL + (StkFloat) *inR) * gain_);
+    }
+
+    // the lowpass is only worked out for the samples the network takes
+    const size_t first = decimation_ - 1 - resamplePhase_;
+    const size_t produced = first < frames ? (frames - first + decimation_ - 1) / decimation_ : 0;
+    FreeVerbSimd::fir(output, x + first, decimation_, produced, decimateFilter_, taps);
+
+    std::copy(x + frames, x + frames + history, decimateHistory_);
+    return produced;
+}
+
+template <typename T>
+void BasicFreeVerb<T>::interpolate(const T* wetL, const T* wetR, size_t netFrames,
+                                   T* outL, T* outR, size_t frames) {
+    // each channel's history followed by the new network output, newest last
+    const size_t history = resampleTaps;
+    T xL[resampleTaps + maxChunk];
+    T xR[resampleTaps + maxChunk];
+    std::copy(interpolateHistory_, interpolateHistory_ + history, xL);
+    std::copy(interpolateHistory_ + resampleTaps, interpolateHistory_ + resampleTaps + history, xR);
+    std::copy(wetL, wetL + netFrames, xL + history);
+    std::copy(wetR, wetR + netFrames, xR + history);
+
+    // frames that share a phase take the same taps over consecutive
+    // network samples, so each phase is one FIR run over the chunk
+    T accL[maxChunk + 1];
+    T accR[maxChunk + 1];
+    for (unsigned int step = 1; step <= decimation_ && step <= frames; step++) {
+        const unsigned int phase = (resamplePhase_ + step) % decimation_;
+        const size_t start = (resamplePhase_ + step) / decimation_;
+        const size_t count = (frames - step) / decimation_ + 1;
+        FreeVerbSimd::fir(accL, xL + start, 1, count, interpolateFilter_ + phase * resampleTaps, resampleTaps);
+        FreeVerbSimd::fir(accR, xR + start, 1, count, interpolateFilter_ + phase * resampleTaps, resampleTaps);
+        for (size_t m = 0; m < count; m++) {
+            outL[step - 1 + m * decimation_] = accL[m];
+            outR[step - 1 + m * decimation_] = accR[m];
+        }
+    }
+    resamplePhase_ = (unsigned int) ((resamplePhase_ + frames) % decimation_);
+
+    std::copy(xL + netFrames, xL + netFrames + history, interpolateHistory_);
+    std::copy(xR + netFrames, xR + netFrames + history, interpolateHistory_ + resampleTaps);
+}
+
+template <typename T>
+template <typename Sample>
+void BasicFreeVerb<T>::processBlock(const Sample* inL, const Sample* inR, unsigned int inStride,
+                                    Sample* outL, Sample* outR, unsigned int outStride, size_t n) {
+    if (n == 0) {
+        return;
+    }
+
+    // parameter changes since the last block take effect here, all at once
+    if (dirty_) {
+        update();
+    }
+
+    // the channel configuration and mix are fixed for the block: mono input
+    // feeds both channels, a missing right output is never computed, and
+    // the dry term goes when it is silent for the whole block
+    const bool stereoIn = (inR != NULL);
+    const bool stereoOut = (outR != NULL);
+    MixMode mode = MIX_DRY;
+    if (wetOnly_) {
+        mode = MIX_WET_ONLY;
+    }
+    else if (ramp_[rampDry] == 0.0 && (!ramping_ || rampStep_[rampDry] == 0.0)) {
+        mode = MIX_WET;
+    }
+    const Mixer<Sample> mix = selectMixer<true, Sample>(stereoIn, stereoOut, mode);
+    const Mixer<Sample> mixBypassed = selectMixer<false, Sample>(stereoIn, stereoOut, mode);
+    if (!inR) {
+        inR = inL;
+    }
+
+    T *arena = arena_.data();
+    const size_t lanes = 2 * numCombs;
+    T fInput[maxChunk];
+    T combs[maxChunk * lanes];
+    T wetL[maxChunk];
+    T wetR[maxChunk];
+
+    // the full rate wet signal in economy mode
+    T upL[maxChunk * maxDecimation];
+    T upR[maxChunk * maxDecimation];
+
+    // denormals are flushed by the FPU for the whole block, kept away by
+    // the DC offset, or undenormalized sample by sample in the kernels; a
+    // single frame is undenormalized rather than pay for switching the FPU
+    // mode twice, which only differs from flushing below about 1e-15
+    const bool flush = (denormals_ == FLUSH_TO_ZERO && n > 1);
+    FreeVerbSimd::DenormalGuard guard(flush);
+    const bool undenormalize = (denormals_ == UNDENORMALIZE || (denormals_ == FLUSH_TO_ZERO && !flush));
+
+    MixState state;
+    state.yL = 0.0;
+    state.yR = 0.0;
+    state.clipsL = 0;
+    state.clipsR = 0;
+    while (n > 0) {
+        size_t frames = std::min(n, chunk_ * decimation_);
+
+        // input peak, while watching for silence
+        StkFloat inputPeak = 0.0;
+        if (bypassLevel_ > 0.0) {
+            const Sample *l = inL, *r = inR;
+            for (size_t t = 0; t < frames; t++, l += inStride, r += inStride) {
+                StkFloat peak = std::max(fabs((StkFloat) *l), fabs((StkFloat) *r));
+                inputPeak = peak > inputPeak ? peak : inputPeak;
+            }
+        }
+
+        // sound, or freezing, brings a bypassed reverb back, its lines already cleared
+        if (bypassed_ && (inputPeak > bypassLevel_ || frozenMode_)) {
+            bypassed_ = false;
+            quietFrames_ = 0;
+        }
+
+        // the comb coefficients hold for the chunk, the output gains ramp across it
+        const StkFloat roomSize = ramp_[rampRoomSize];
+        const StkFloat damp = ramp_[rampDamp];
+        state.wet1 = ramp_[rampWet1];
+        state.wet2 = ramp_[rampWet2];
+        state.dry = ramp_[rampDry];
+        advanceRamps(frames);
+        state.wet1Step = (ramp_[rampWet1] - state.wet1) / frames;
+        state.wet2Step = (ramp_[rampWet2] - state.wet2) / frames;
+        state.dryStep = (ramp_[rampDry] - state.dry) / frames;
+
+        // a bypassed reverb has no wet signal, skip the network
+        if (bypassed_) {
+            mixBypassed(NULL, NULL, inL, inR, inStride, outL, outR, outStride, frames, state);
+            inL += frames * inStride;
+            inR += frames * inStride;
+            outL += frames * outStride;
+            if (stereoOut) {
+                outR += frames * outStride;
+            }
+
+            n -= frames;
+            continue;
+        }
+
+        // gain
+        size_t netFrames = frames;
+        if (decimation_ == 1 && stereoIn) {
+            const Sample *l = inL, *r = inR;
+            for (size_t t = 0; t < frames; t++, l += inStride, r += inStride) {
+                fInput[t] = (T) (((StkFloat) *l + (StkFloat) *r) * gain_);
+            }
+        }
+        else if (decimation_ == 1) {
+            const Sample *l = inL;
+            for (size_t t = 0; t < frames; t++, l += inStride) {
+                StkFloat x = *l;
+                fInput[t] = (T) ((x + x) * gain_);
+            }
+        }
+        else {
+            netFrames = decimate(inL, inR, inStride, frames, fInput);
+        }
+        if (denormals_ == DC_OFFSET) {
+            for (; dcCountdown_ < netFrames; dcCountdown_ += denormalOffsetFrames) {
+                fInput[dcCountdown_] += (T) dcOffset_;
+                dcOffset_ = -dcOffset_;
+            }
+            dcCountdown_ -= (unsigned int) netFrames;
+        }
+
+        // a single frame, as from tick(), is cheaper run straight through the network
+        if (netFrames == 1) {
+            if (undenormalize) {
+                networkFrame<true>(fInput[0], combs, wetL, wetR, (T) roomSize, (T) damp, (T) (1.0 - damp));
+            }
+            else {
+                networkFrame<false>(fInput[0], combs, wetL, wetR, (T) roomSize, (T) damp, (T) (1.0 - damp));
+            }
         }
         else {
-            *oSamples = tick(*iSamples);
+            // 8 LBCF filters in parallel per channel, one comb per vector lane
+            for (int i = 0; i < numCombs; i++) {
+                readDelay(combs + i, lanes, arena + combDelayL_[i].offset, combDelayL_[i], netFrames);
+                readDelay(combs + numCombs + i, lanes, arena + combDelayR_[i].offset, combDelayR_[i], netFrames);
+            }
+
+            FreeVerbSimd::combBank(combs, fInput, combFilter_, lanes, netFrames, (T) roomSize, (T) damp,
+                                   (T) (1.0 - damp), undenormalize);
+
+            std::fill(wetL, wetL + netFrames, T(0));
+            std::fill(wetR, wetR + netFrames, T(0));
+            for (int i = 0; i < numCombs; i++) {
+                writeDelay(arena + combDelayL_[i].offset, combDelayL_[i], combs + i, lanes, wetL, netFrames);
+                writeDelay(arena + combDelayR_[i].offset, combDelayR_[i], combs + numCombs + i, lanes, wetR,
+                           netFrames);
+            }
+
+            // 4 allpass filters in series
+            for (int i = 0; i < numAllPasses; i++) {
+                allPassDelay(wetL, arena + allPassDelayL_[i].offset, allPassDelayL_[i], netFrames, (T) g_,
+                             undenormalize);
+                allPassDelay(wetR, arena + allPassDelayR_[i].offset, allPassDelayR_[i], netFrames, (T) g_,
+                             undenormalize);
+            }
         }
 
-        // if oFrames is stereo
-        if(oNumChannels == 2) {
-            *(oSamples+1) = lastFrame_[1];
+        // the network is quiet for long enough: drop to dry only, and never
+        // while frozen. What reaches the output is the sum of a channel's
+        // combs through the allpasses, scaled by up to the sum of the wet
+        // gains, so both the sum of the combs' magnitudes, which bounds the
+        // allpass input, and the allpass output must stay below the level
+        // once scaled, not each comb on its own
+        if (bypassLevel_ > 0.0) {
+            bool quiet = inputPeak <= bypassLevel_ && !frozenMode_;
+            const StkFloat wetGain = std::max(fabs(state.wet1), fabs(ramp_[rampWet1]))
+                                   + std::max(fabs(state.wet2), fabs(ramp_[rampWet2]));
+            if (quiet && wetGain > 0.0) {
+                const T level = (T) (bypassLevel_ / wetGain);
+                for (size_t t = 0; t < netFrames; t++) {
+                    const T *row = combs + t * lanes;
+                    T sumL = 0, sumR = 0;
+                    for (int i = 0; i < numCombs; i++) {
+                        sumL += fabs(row[i]);
+                        sumR += fabs(row[numCombs + i]);
+                    }
+                    quiet &= (sumL <= level) & (sumR <= level)
+                           & (fabs(wetL[t]) <= level) & (fabs(wetR[t]) <= level);
+                }
+            }
+            quietFrames_ = quiet ? quietFrames_ + frames : 0;
+        }
+
+        // back up to the full rate in economy mode
+        const T *wl = wetL, *wr = wetR;
+        if (decimation_ > 1) {
+            interpolate(wetL, wetR, netFrames, upL, upR, frames);
+            wl = upL;
+            wr = upR;
+        }
+
+        mix(wl, wr, inL, inR, inStride, outL, outR, outStride, frames, state);
+        inL += frames * inStride;
+        inR += frames * inStride;
+        outL += frames * outStride;
+        if (stereoOut) {
+            outR += frames * outStride;
+        }
+
+        n -= frames;
+
+        if (quietFrames_ >= quietFramesNeeded_ && bypassLevel_ > 0.0) {
+            clearLines();
+            bypassed_ = true;
         }
     }
 
-    return oFrames;
+    lastFrame_[0] = state.yL;
+    lastFrame_[1] = state.yR;
+    clips_[0] += state.clipsL;
+    clips_[1] += state.clipsR;
+}
+
+template <typename T>
+template <bool StereoIn, bool StereoOut, int Mode, bool Wet, typename Sample>
+void BasicFreeVerb<T>::mixChunk(const T* wetL, const T* wetR, const Sample* inL, const Sample* inR,
+                                unsigned int inStride, Sample* outL, Sample* outR, unsigned int outStride,
+                                size_t frames, MixState& state) {
+    // gains that hold still across the chunk let the frames go in parallel
+    if (state.wet1Step == 0.0 && state.wet2Step == 0.0 && state.dryStep == 0.0) {
+        mixFrames<StereoIn, StereoOut, Mode, Wet, false>(wetL, wetR, inL, inR, inStride, outL, outR, outStride,
+                                                         frames, state);
+    }
+    else {
+        mixFrames<StereoIn, StereoOut, Mode, Wet, true>(wetL, wetR, inL, inR, inStride, outL, outR, outStride,
+                                                        frames, state);
+    }
 }
+
+template <typename T>
+template <bool StereoIn, bool StereoOut, int Mode, bool Wet, bool Ramped, typename Sample>
+void BasicFreeVerb<T>::mixFrames(const T* wetL, const T* wetR, const Sample* inL, const Sample* inR,
+                                 unsigned int inStride, Sample* outL, Sample* outR, unsigned int outStride,
+                                 size_t frames, MixState& state) {
+    // everything the loop needs in locals, so no store to the output can change it
+    StkFloat wet1 = state.wet1;
+    StkFloat wet2 = state.wet2;
+    StkFloat dry = state.dry;
+    const StkFloat wet1Step = state.wet1Step;
+    const StkFloat wet2Step = state.wet2Step;
+    const StkFloat dryStep = state.dryStep;
+    StkFloat lastL = state.yL;
+    StkFloat lastR = state.yR;
+    unsigned long clipsL = 0;
+    unsigned long clipsR = 0;
+    for (size_t t = 0; t < frames; t++) {
+        StkFloat inputL = inL[t * inStride];
+        StkFloat inputR = StereoIn ? (StkFloat) inR[t * inStride] : inputL;
+
+        // mix output
+        StkFloat yL = 0.0;
+        StkFloat yR = 0.0;
+        if (Wet) {
+            yL = wetL[t]*wet1 + wetR[t]*wet2;
+            yR = wetR[t]*wet1 + wetL[t]*wet2;
+        }
+        if (Mode == MIX_DRY) {
+            yL = Wet ? yL + inputL*dry : inputL*dry;
+            yR = Wet ? yR + inputR*dry : inputR*dry;
+        }
+        if (Ramped) {
+            wet1 += wet1Step;
+            wet2 += wet2Step;
+            dry += dryStep;
+        }
+
+        if (Mode != MIX_WET_ONLY) {
+            clipsL += (yL >= 1.0) | (yL <= -1.0);
+            yL = limit(yL);
+            if (StereoOut) {
+                clipsR += (yR >= 1.0) | (yR <= -1.0);
+                yR = limit(yR);
+            }
+        }
+
+        outL[t * outStride] = (Sample) yL;
+        lastL = yL;
+        if (StereoOut) {
+            outR[t * outStride] = (Sample) yR;
+            lastR = yR;
+        }
+    }
+
+    state.yL = lastL;
+    state.yR = lastR;
+    state.clipsL += clipsL;
+    state.clipsR += clipsR;
+}
+
+template <typename T>
+template <bool Wet, typename Sample>
+typename BasicFreeVerb<T>::template Mixer<Sample> BasicFreeVerb<T>::selectMixer(bool stereoIn, bool stereoOut,
+                                                                                  MixMode mode) {
+    static const Mixer<Sample> mixers[2][2][3] = {
+        { { mixChunk<false, false, MIX_DRY, Wet, Sample>,
+            mixChunk<false, false, MIX_WET, Wet, Sample>,
+            mixChunk<false, false, MIX_WET_ONLY, Wet, Sample> },
+          { mixChunk<false, true, MIX_DRY, Wet, Sample>,
+            mixChunk<false, true, MIX_WET, Wet, Sample>,
+            mixChunk<false, true, MIX_WET_ONLY, Wet, Sample> } },
+        { { mixChunk<true, false, MIX_DRY, Wet, Sample>,
+            mixChunk<true, false, MIX_WET, Wet, Sample>,
+            mixChunk<true, false, MIX_WET_ONLY, Wet, Sample> },
+          { mixChunk<true, true, MIX_DRY, Wet, Sample>,
+            mixChunk<true, true, MIX_WET, Wet, Sample>,
+            mixChunk<true, true, MIX_WET_ONLY, Wet, Sample> } }
+    };
+    return mixers[stereoIn][stereoOut][mode];
+}
+
+template class stk::BasicFreeVerb<StkFloat>;
+template class stk::BasicFreeVerb<float>;
@@ -2,8 +2,8 @@
 #define STK_FREEVERB_H
 
 #include "Effect.h"
-#include "Delay.h"
-#include "OnePole.h"
+#include "AlignedBuffer.h"
+#include <cstddef>
 
 namespace stk {
 
@@ -19,11 +19,18 @@ namespace stk {
     The input signal can be either mono or stereo, and the output signal
     is stereo.
 
+    The delay lines and filter states are held in T. FreeVerb keeps them
+    in StkFloat; FreeVerbFloat keeps them in float, which halves their
+    memory and doubles the lanes of every vector kernel. Either accepts
+    float or StkFloat audio, and the output mix is always computed in
+    StkFloat.
+
     ported by Gregory Burlet, 2012.
 */
 /***************************************************************************/
 
-class FreeVerb : public Effect
+template <typename T>
+class BasicFreeVerb : public Effect
 {   
     public:
         //! FreeVerb Constructor
@@ -38,10 +45,10 @@ class FreeVerb : public Effect
             Width: 1.0
             Mode: freeze mode off
         */
-        FreeVerb();
+        BasicFreeVerb();
 
         //! Destructor
-        ~FreeVerb();
+        ~BasicFreeVerb();
 
         //! set the effect mix [0,1]
         /*!
@@ -73,28 +80,244 @@ class FreeVerb : public Effect
         //! get the current freeze mode
         StkFloat getMode();
 
+        //! every user parameter, for setting or reading them all at once
+        struct Parameters {
+            //! FreeVerb's defaults
+            Parameters() : mix(0.75), roomSize(0.75), damp(0.25), width(1.0), frozen(false) {}
+
+            StkFloat mix;       //!< effect mix [0,1]
+            StkFloat roomSize;  //!< room size [0,1]
+            StkFloat damp;      //!< damping [0,1]
+            StkFloat width;     //!< width [0,1]
+            bool frozen;        //!< freeze mode
+        };
+
+        //! set every parameter in one step
+        void setParameters(const Parameters& parameters);
+
+        //! get every parameter
+        Parameters getParameters();
+
+        //! render only the reverberated signal, without the dry signal or the limiter
+        /*!
+          Outside freeze mode the wet signal is linear in the input, so pieces
+          of a signal can be rendered separately in this mode and summed.
+          mixDry() then completes the sum as tick() would have.
+        */
+        void setWetOnly(bool wetOnly);
+
+        //! add the dry signal to wet-only output and apply the limiter
+        /*!
+          iFrames is the input that produced oFrames, which is completed in place.
+        */
+        StkFrames& mixDry(const StkFrames& iFrames, StkFrames& oFrames);
+
+        //! the number of frames for the response to an impulse to decay below level
+        /*!
+          A conservative bound from the comb feedback and allpass gains. In
+          freeze mode the response never decays and the largest unsigned long
+          is returned.
+        */
+        unsigned long tailFrames(StkFloat level);
+
+        //! ways of keeping denormals out of the feedback paths
+        enum Denormals {
+            UNDENORMALIZE,  /*!< undenormalize() every feedback sample, as the original FreeVerb */
+            FLUSH_TO_ZERO,  /*!< set FTZ/DAZ on the processing thread for each block, undenormalize single frames */
+            DC_OFFSET       /*!< add an inaudible offset to the comb input every 64 frames */
+        };
+
+        //! select how denormals are avoided
+        /*!
+          The default is FLUSH_TO_ZERO where the CPU supports it and
+          DC_OFFSET elsewhere, which FLUSH_TO_ZERO also falls back to.
+          UNDENORMALIZE reproduces the original output bit for bit at
+          every FreeVerbSimd level.
+        */
+        void setDenormals(Denormals denormals);
+
+        //! get the denormal strategy in use
+        Denormals getDenormals();
+
+        //! bypass the reverb while input and tail stay below level
+        /*!
+          level bounds the input peak and the wet output: each channel's
+          combs, summed by magnitude, and its allpass output, both scaled
+          by the sum of the wet gains. Once all of them have stayed below
+          level for as long as a sample takes to pass through the network,
+          the lines are cleared and the reverb outputs only the dry
+          signal, at almost no cost, until the input rises above level
+          again. The tail that is cut is then about level at most. Freeze
+          mode is never bypassed. 0, the default, never bypasses.
+        */
+        void setBypassLevel(StkFloat level);
+
+        //! returns true while the reverb is bypassed for silence
+        bool isBypassed();
+
+        //! run the reverb network at a fraction of the sampling rate
+        /*!
+          An economy mode for high sampling rates: with a factor of 2 or 4
+          the input to the combs is lowpassed and decimated, the comb and
+          allpass network runs at half or quarter rate with delay lines
+          sized for it, and its output is interpolated back up with
+          polyphase filters. The dry signal stays at the full rate. The
+          tail rolls off above about a third of the reduced rate and is
+          delayed by resampleTaps frames of the reduced rate. 1, the
+          default, runs everything at the full rate. Changing the factor
+          reallocates and clears the delay lines.
+        */
+        void setDecimation(unsigned int factor);
+
+        //! get the decimation factor
+        unsigned int getDecimation();
+
+        //! the number of output samples of a channel the hard limiter has clipped
+        unsigned long getClipCount(unsigned int channel);
+
+        //! start counting clipped samples again from zero
+        void resetClipCounts();
+
+        //! shapes of the glide to new parameter values
+        enum Smoothing {
+            LINEAR,     /*!< a straight line, arriving after the smoothing time */
+            ONE_POLE    /*!< an exponential approach, with the smoothing time as its time constant */
+        };
+
+        //! glide the room size, damping and output gains to new values over time seconds
+        /*!
+          Changes then ramp inside the block loop instead of jumping, so
+          parameters can be set once per block without zipper noise. The
+          output gains move every frame and the comb coefficients every
+          kernel chunk of up to maxChunk frames. The default time of 0
+          applies changes at once.
+        */
+        void setSmoothing(StkFloat time, Smoothing shape = LINEAR);
+
         //! update parameters
         /*!
           Since some changes in parameters are interdependent,
-          this keeps everything in sync.
+          this keeps everything in sync. The setters only mark the
+          parameters as changed, and this is called once when the next
+          block is processed; there is no need to call it directly.
         */
         void update();
 
         //! clears delay lines, etc.
+        /*!
+          Takes constant time: the delay lines are rewound and read as
+          silence until each has been written all the way round, their
+          old samples zeroed only as processing reaches them. The output
+          is silent from the next sample on.
+        */
         void clear();
 
+        //! the number of bytes snapshot() writes
+        size_t snapshotSize();
+
+        //! write the whole state of the reverb to buffer
+        /*!
+          The parameters, the values ramping towards them, the delay
+          lines, the filter states and the bypass and economy mode
+          state, enough for restore() to carry on exactly where this
+          reverb is. Each delay line is written from its samples alone,
+          without the arena's padding. The snapshot is in the native
+          byte order and starts with snapshotVersion. Returns the bytes
+          written, or 0 if size is less than snapshotSize().
+        */
+        size_t snapshot(void* buffer, size_t size);
+
+        //! restore a state written by snapshot()
+        /*!
+          The snapshot must come from a reverb with the same sample type
+          and snapshotVersion, and delay lines of the same lengths; a
+          different decimation factor is taken over along with the rest.
+          Returns false, leaving this reverb as it was, if it does not
+          fit.
+        */
+        bool restore(const void* buffer, size_t size);
+
+        //! a new reverb in the same state as this one, for the caller to delete
+        BasicFreeVerb* clone();
+
+        //! the layout of snapshot(), changed whenever the state it holds changes
+        static const unsigned int snapshotVersion = 2;
+
         //! returns the last calculated value of the effect for the given channel
         StkFloat lastOut(unsigned int channel = 0);
 
-        //! Provide one sample of mono or stereo import and return the given calculated channel
-        StkFloat tick(StkFloat inputL, StkFloat inputR = 0.0, unsigned int channel = 0);
+        //! Provide one sample of mono input and return the left channel, the right is in lastOut(1)
+        StkFloat tick(StkFloat input);
 
-        //! Provide a frame of input (mono or stereo) and calculate stereo reverbed output with replacement
+        //! Provide one sample of stereo input and return the given calculated channel
+        /*!
+          inputR is always the right input, even when it is 0.0; use
+          tick(input) for mono input.
+        */
+        StkFloat tick(StkFloat inputL, StkFloat inputR, unsigned int channel = 0);
+
+        //! Provide a frame of input (mono or stereo) and calculate reverbed output with replacement
+        /*!
+          Mono frames get the left channel of the output, and lastOut(1)
+          is not calculated.
+        */
         StkFrames& tick(StkFrames& frames);
 
         //! Provide a frame of input (mono or stereo) and calculate stereo reverbed output without replacement
         StkFrames& tick(StkFrames& iFrames, StkFrames &oFrames);
 
+        //! Process a block of planar audio
+        /*!
+          The filter state is held in locals for the whole block rather than
+          going through tick() once per frame. Pass inR = NULL for mono input,
+          in which case inL feeds both channels, and outR = NULL if only the
+          left output is wanted. Input and output buffers may be the same.
+        */
+        void process(const float* inL, const float* inR, float* outL, float* outR, size_t n);
+
+        //! Process a block of planar audio in StkFloat precision
+        void process(const StkFloat* inL, const StkFloat* inR, StkFloat* outL, StkFloat* outR, size_t n);
+
+        //! Process a block of interleaved audio, such as a device buffer
+        /*!
+          Runs the block kernel in place on the interleaved frames, so a
+          driver's buffers need no copying into planar ones. One input
+          channel is mono input; with more, the first two are the left and
+          right channels. One output channel gets only the left output;
+          with more, the first two get the left and right outputs and the
+          rest are left untouched. Input and output may be the same buffer
+          when they have the same number of channels.
+        */
+        void processInterleaved(const float* in, unsigned int inChannels,
+                                float* out, unsigned int outChannels, size_t n);
+
+        //! Process a block of interleaved audio in StkFloat precision
+        void processInterleaved(const StkFloat* in, unsigned int inChannels,
+                                StkFloat* out, unsigned int outChannels, size_t n);
+
+        //! one source feeding a send bus, see processSends()
+        template <typename Sample>
+        struct Send {
+            const Sample* left;     //!< left channel, or the only one
+            const Sample* right;    //!< right channel, NULL for a mono source
+            StkFloat gain;          //!< send level
+        };
+
+        //! Run the reverb as a send bus fed by any number of sources
+        /*!
+          The network only hears the sum of its input channels, so each
+          source's channels are summed, scaled by its send gain and added
+          into the input stage chunk by chunk, with no full length buffer
+          for the bus. The return in outL and outR is wet-only, as with
+          setWetOnly(true), whatever that is set to. Every source buffer
+          holds n frames. outR may be NULL.
+        */
+        void processSends(const Send<float>* sends, unsigned int numSends, float* outL, float* outR, size_t n);
+
+        //! Run the reverb as a send bus in StkFloat precision
+        void processSends(const Send<StkFloat>* sends, unsigned int numSends,
+                          StkFloat* outL, StkFloat* outR, size_t n);
+
         // to clamp very small floats to zero
         // in original FreeVerb implementation, but flawed.
         // fixed version taken from:
@@ -103,22 +326,136 @@ class FreeVerb : public Effect
             s += 9.8607615E-32f; 
             return s - 9.8607615E-32f; 
         }
+
+        // the same in float, where the sum must be rounded to float to flush
+        static inline float undenormalize(volatile float s) { 
+            s += 9.8607615E-32f; 
+            return s - 9.8607615E-32f; 
+        }
     
         static const int numCombs = 8;
         static const int numAllPasses = 4;
+        static const int maxChunk = 64;     // frames handed to the vector kernels at once
+        static const int maxDecimation = 4;
+        static const int resampleTaps = 16; // decimation and interpolation filter taps per phase
         static const int stereoSpread = 23;
-        static const StkFloat fixedGain = 0.015;
-        static const StkFloat scaleWet = 3;
-        static const StkFloat scaleDry = 2;
-        static const StkFloat scaleDamp = 0.4;
-        static const StkFloat scaleRoom = 0.28;
-        static const StkFloat offsetRoom = 0.7;
+        static constexpr StkFloat fixedGain = 0.015;
+        static constexpr StkFloat scaleWet = 3;
+        static constexpr StkFloat scaleDry = 2;
+        static constexpr StkFloat scaleDamp = 0.4;
+        static constexpr StkFloat scaleRoom = 0.28;
+        static constexpr StkFloat offsetRoom = 0.7;
 
         // delay line lengths for 44100Hz sampling rate
-        static int cDelayLen[numCombs];
-        static int aDelayLen[numAllPasses];
+        static const int cDelayLen[numCombs];
+        static const int aDelayLen[numAllPasses];
+
+        //! delay line lengths at one sampling rate
+        struct DelayLengths {
+            int comb[numCombs];
+            int allPass[numAllPasses];
+        };
+
+        //! returns the delay line lengths for a sampling rate
+        /*!
+          44.1, 48, 88.2, 96 and 192kHz come from precomputed tables,
+          other rates are scaled from the 44100Hz lengths.
+        */
+        static DelayLengths delayLengths(StkFloat rate);
+
+        //! a ring buffer of exactly its delay length within the delay line arena
+        /*!
+          Each sample is read and then overwritten at index, so the ring
+          delays by its length. A stale ring still holds samples from
+          before the last clear() from index on, which read as zero until
+          they have been overwritten.
+        */
+        struct DelayLine {
+            size_t offset;          // position of the first sample in the arena
+            unsigned int length;    // delay in samples
+            unsigned int index;     // read and write position
+            bool stale;             // cleared, but not yet written all the way round
+        };
 
     protected:
+        // size and place every delay line for the current decimation
+        void layoutDelayLines();
+
+        // block kernel shared by every tick() and process() entry point
+        template <typename Sample>
+        void processBlock(const Sample* inL, const Sample* inR, unsigned int inStride,
+                          Sample* outL, Sample* outR, unsigned int outStride, size_t n);
+
+        // sum the sends a stretch at a time and hand each to processBlock()
+        template <typename Sample>
+        void processSendsBlock(const Send<Sample>* sends, unsigned int numSends,
+                               Sample* outL, Sample* outR, size_t n);
+
+        // how a block's output is mixed: with the dry signal, without it
+        // because it is silent, or wet-only with no limiter either
+        enum MixMode { MIX_DRY, MIX_WET, MIX_WET_ONLY };
+
+        // a chunk's ramped output gains, and what the mix carries to the next chunk
+        struct MixState {
+            StkFloat wet1, wet2, dry;
+            StkFloat wet1Step, wet2Step, dryStep;
+            StkFloat yL, yR;
+            unsigned long clipsL, clipsR;
+        };
+
+        // mixes a chunk of output, with no wet signal when Wet is false
+        template <typename Sample>
+        using Mixer = void (*)(const T* wetL, const T* wetR, const Sample* inL, const Sample* inR,
+                               unsigned int inStride, Sample* outL, Sample* outR, unsigned int outStride,
+                               size_t frames, MixState& state);
+
+        // one mixer for every configuration, so none of them branches per frame
+        template <bool StereoIn, bool StereoOut, int Mode, bool Wet, typename Sample>
+        static void mixChunk(const T* wetL, const T* wetR, const Sample* inL, const Sample* inR,
+                             unsigned int inStride, Sample* outL, Sample* outR, unsigned int outStride,
+                             size_t frames, MixState& state);
+
+        // the frame loop of mixChunk(), Ramped when the gains move
+        template <bool StereoIn, bool StereoOut, int Mode, bool Wet, bool Ramped, typename Sample>
+        static void mixFrames(const T* wetL, const T* wetR, const Sample* inL, const Sample* inR,
+                              unsigned int inStride, Sample* outL, Sample* outR, unsigned int outStride,
+                              size_t frames, MixState& state);
+
+        // pick the mixer for a block's configuration
+        template <bool Wet, typename Sample>
+        static Mixer<Sample> selectMixer(bool stereoIn, bool stereoOut, MixMode mode);
+
+        // economy mode: lowpass the comb input and keep the samples the network takes,
+        // returns how many there were
+        template <typename Sample>
+        size_t decimate(const Sample* inL, const Sample* inR, unsigned int inStride,
+                        size_t frames, T* output);
+
+        // economy mode: bring netFrames of network output back up to frames at the full rate
+        void interpolate(const T* wetL, const T* wetR, size_t netFrames, T* outL, T* outR, size_t frames);
+
+        // one frame through the combs and allpasses: the kernels' arithmetic
+        // without the per-call cost of handing them a block, for tick()
+        template <bool Undenormalize>
+        void networkFrame(T input, T* combs, T* wetL, T* wetR, T roomSize, T damp1, T damp2);
+
+        // move the ramped values on by frames towards their targets
+        void advanceRamps(size_t frames);
+
+        // jump the ramped values to their targets
+        void finishRamps();
+
+        // silence the delay lines and zero the filter states
+        void clearLines();
+
+        // zero what is left of every stale delay line
+        void settleLines();
+
+        // hand every field a snapshot holds to visit, in snapshot order,
+        // so sizing, writing and reading one share the same list
+        template <typename Visitor>
+        void visitState(Visitor& visit);
+
         StkFloat g_;        // allpass coefficient
         StkFloat gain_;
         StkFloat roomSizeMem_, roomSize_;
@@ -127,18 +464,70 @@ class FreeVerb : public Effect
         StkFloat dry_;
         StkFloat width_;
         bool frozenMode_;
+        bool wetOnly_;
+        bool dirty_;            // parameters changed since the last update()
+        Denormals denormals_;
+        StkFloat dcOffset_;     // flips sign each time it is added so it never builds up
+        unsigned int dcCountdown_;  // network frames until it is added next
+
+        // the values in use for the parameters that ramp to the ones update() sets
+        enum { rampRoomSize, rampDamp, rampWet1, rampWet2, rampDry, numRamps };
+        StkFloat ramp_[numRamps];
+        StkFloat rampStep_[numRamps];   // per frame, for LINEAR
+        unsigned long rampLeft_;        // frames to go, for LINEAR
+        bool ramping_;
+        StkFloat smoothFrames_;
+        Smoothing smoothing_;
+
+        // silence detection for the bypass
+        StkFloat bypassLevel_;
+        unsigned long quietFrames_;         // frames of quiet input and comb output so far
+        unsigned long quietFramesNeeded_;   // longest path through the network
+        bool bypassed_;
+
+        // samples clipped by the limiter, per channel
+        unsigned long clips_[2];
+
+        // every delay line lives in this one cache line aligned allocation,
+        // each left channel line followed by its right channel partner
+        AlignedBuffer<T> arena_;
 
         // LBFC: Lowpass Feedback Comb Filters
-        Delay combDelayL_[numCombs];
-        Delay combDelayR_[numCombs];
-        OnePole combFilterL_[numCombs];
-        OnePole combFilterR_[numCombs];
+        DelayLine combDelayL_[numCombs];
+        DelayLine combDelayR_[numCombs];
+
+        // one pole lowpass in the comb feedback path: y[n] = damp2_*x[n] + damp1_*y[n-1]
+        // one lane per comb filter, left channel first, as FreeVerbSimd::combBank() expects
+        T combFilter_[2 * numCombs];
+        StkFloat damp1_, damp2_;
         
         // AP: Allpass Filters
-        Delay allPassDelayL_[numAllPasses];
-        Delay allPassDelayR_[numAllPasses];
+        DelayLine allPassDelayL_[numAllPasses];
+        DelayLine allPassDelayR_[numAllPasses];
+
+        // frames per kernel call, never longer than the shortest delay line
+        // so a chunk never reads back what it wrote itself
+        size_t chunk_;
+
+        // economy mode, the network running at 1/decimation_ of the rate
+        unsigned int decimation_;
+        unsigned int resamplePhase_;    // frames since the network last took a sample
+        T decimateFilter_[maxDecimation * resampleTaps];
+        T interpolateFilter_[maxDecimation * resampleTaps];
+        T decimateHistory_[maxDecimation * resampleTaps];     // newest input last
+        T interpolateHistory_[2 * resampleTaps];              // newest network output last, per channel
 };
 
+//! FreeVerb with StkFloat delay lines and state
+typedef BasicFreeVerb<StkFloat> FreeVerb;
+
+//! FreeVerb with float delay lines and state
+typedef BasicFreeVerb<float> FreeVerbFloat;
+
+// both are instantiated in FreeVerb.cpp
+extern template class BasicFreeVerb<StkFloat>;
+extern template class BasicFreeVerb<float>;
+
 }
 
 #endif
@@ -0,0 +1,317 @@
+/**************************************************************************/
+/*! \class FreeVerbBank
+    \brief Many independent FreeVerb reverbs processed together
+
+    Holds the state of a number of FreeVerb voices in struct-of-arrays
+    form: every delay line stores one lane per voice at each position,
+    so one step of a comb or allpass filter for all voices is a single
+    contiguous run of memory and is vectorized across voices. Each voice
+    has its own effect mix, room size, damping, width and freeze mode,
+    mapped exactly as in FreeVerb, and sounds the same as a FreeVerb
+    with those settings.
+*/
+/***************************************************************************/
+
+#include "FreeVerbBank.h"
+#include "FreeVerbSimd.h"
+#include "FreeVerbLines.h"
+#include <math.h>
+#include <algorithm>
+
+using namespace stk;
+
+// scratch samples per channel sum; with many voices the chunk gets shorter to stay in cache
+static const size_t scratchSamples = 4096;
+
+FreeVerbBank::FreeVerbBank(unsigned int voices)
+    : voices_(voices), mix_(voices), roomSizeMem_(voices), roomSize_(voices), dampMem_(voices),
+      damp1_(voices), damp2_(voices), width_(voices), gain_(voices), wet1_(voices), wet2_(voices),
+      dry_(voices), frozenMode_(voices), dirty_(voices), combFilter_(2 * FreeVerb::numCombs * voices) {
+    // same defaults as FreeVerb
+    for (unsigned int v = 0; v < voices_; v++) {
+        mix_[v] = 0.75;
+        roomSizeMem_[v] = (0.75 * FreeVerb::scaleRoom) + FreeVerb::offsetRoom;
+        dampMem_[v] = 0.25 * FreeVerb::scaleDamp;
+        width_[v] = 1.0;
+        frozenMode_[v] = false;
+        update(v);
+    }
+    anyDirty_ = false;
+
+    // delay line lengths as FreeVerb uses them at the current sampling rate
+    FreeVerb::DelayLengths lengths = FreeVerb::delayLengths(Stk::sampleRate());
+
+    size_t arenaSize = 0;
+    for (int i = 0; i < FreeVerb::numCombs; i++) {
+        arenaSize = placeDelayLine<StkFloat>(combDelayL_[i], lengths.comb[i], arenaSize, voices_);
+        arenaSize = placeDelayLine<StkFloat>(combDelayR_[i], lengths.comb[i] + FreeVerb::stereoSpread,
+                                             arenaSize, voices_);
+    }
+    for (int i = 0; i < FreeVerb::numAllPasses; i++) {
+        arenaSize = placeDelayLine<StkFloat>(allPassDelayL_[i], lengths.allPass[i], arenaSize, voices_);
+        arenaSize = placeDelayLine<StkFloat>(allPassDelayR_[i], lengths.allPass[i] + FreeVerb::stereoSpread,
+                                             arenaSize, voices_);
+    }
+    arena_.resize(arenaSize);
+
+    // a chunk must be shorter than every delay line, as in FreeVerb
+    chunk_ = FreeVerb::maxChunk;
+    for (int i = 0; i < FreeVerb::numCombs; i++) {
+        chunk_ = std::min(chunk_, (size_t) lengths.comb[i]);
+    }
+    for (int i = 0; i < FreeVerb::numAllPasses; i++) {
+        chunk_ = std::min(chunk_, (size_t) lengths.allPass[i]);
+    }
+    if (voices_ > 0) {
+        chunk_ = std::min(chunk_, scratchSamples / voices_);
+    }
+    chunk_ = std::max(chunk_, (size_t) 1);
+
+    input_.resize(chunk_ * voices_);
+    sumL_.resize(chunk_ * voices_);
+    sumR_.resize(chunk_ * voices_);
+}
+
+FreeVerbBank::~FreeVerbBank() {}
+
+void FreeVerbBank::setMix(unsigned int voice, StkFloat value) {
+    if (value < 0.0) {
+        oStream_ << "FreeVerbBank::setMix: mix parameter is less than zero ... setting to zero!";
+        handleError(StkError::WARNING);
+        value = 0.0;
+    }
+    else if (value > 1.0) {
+        oStream_ << "FreeVerbBank::setMix: mix parameter is greater than one ... setting to one!";
+        handleError(StkError::WARNING);
+        value = 1.0;
+    }
+
+    mix_[voice] = value;
+    markDirty(voice);
+}
+
+StkFloat FreeVerbBank::getMix(unsigned int voice) {
+    return mix_[voice];
+}
+
+void FreeVerbBank::setRoomSize(unsigned int voice, StkFloat value) {
+    roomSizeMem_[voice] = (value * FreeVerb::scaleRoom) + FreeVerb::offsetRoom;
+    markDirty(voice);
+}
+
+StkFloat FreeVerbBank::getRoomSize(unsigned int voice) {
+    return (roomSizeMem_[voice] - FreeVerb::offsetRoom) / FreeVerb::scaleRoom;
+}
+
+void FreeVerbBank::setDamp(unsigned int voice, StkFloat value) {
+    dampMem_[voice] = value * FreeVerb::scaleDamp;
+    markDirty(voice);
+}
+
+StkFloat FreeVerbBank::getDamp(unsigned int voice) {
+    return dampMem_[voice] / FreeVerb::scaleDamp;
+}
+
+void FreeVerbBank::setWidth(unsigned int voice, StkFloat value) {
+    width_[voice] = value;
+    markDirty(voice);
+}
+
+StkFloat FreeVerbBank::getWidth(unsigned int voice) {
+    return width_[voice];
+}
+
+void FreeVerbBank::setMode(unsigned int voice, bool isFrozen) {
+    frozenMode_[voice] = isFrozen;
+    markDirty(voice);
+}
+
+bool FreeVerbBank::getMode(unsigned int voice) {
+    return frozenMode_[voice];
+}
+
+void FreeVerbBank::setParameters(unsigned int voice, const FreeVerb::Parameters& parameters) {
+    setMix(voice, parameters.mix);
+    roomSizeMem_[voice] = (parameters.roomSize * FreeVerb::scaleRoom) + FreeVerb::offsetRoom;
+    dampMem_[voice] = parameters.damp * FreeVerb::scaleDamp;
+    width_[voice] = parameters.width;
+    frozenMode_[voice] = parameters.frozen;
+    markDirty(voice);
+}
+
+FreeVerb::Parameters FreeVerbBank::getParameters(unsigned int voice) {
+    FreeVerb::Parameters parameters;
+    parameters.mix = mix_[voice];
+    parameters.roomSize = getRoomSize(voice);
+    parameters.damp = getDamp(voice);
+    parameters.width = width_[voice];
+    parameters.frozen = frozenMode_[voice];
+    return parameters;
+}
+
+void FreeVerbBank::update(unsigned int voice) {
+    StkFloat wet = FreeVerb::scaleWet * mix_[voice];
+    StkFloat dry = FreeVerb::scaleDry * (1.0 - mix_[voice]);
+
+    // same L1 normalization as FreeVerb::update()
+    wet /= (wet + dry);
+    dry /= (wet + dry);
+
+    wet1_[voice] = wet * (width_[voice]/2.0 + 0.5);
+    wet2_[voice] = wet * (1.0 - width_[voice])/2.0;
+    dry_[voice] = dry;
+
+    StkFloat damp;
+    if (frozenMode_[voice]) {
+        roomSize_[voice] = 1.0;
+        damp = 0.0;
+        gain_[voice] = 0.0;
+    }
+    else {
+        roomSize_[voice] = roomSizeMem_[voice];
+        damp = dampMem_[voice];
+        gain_[voice] = FreeVerb::fixedGain;
+    }
+
+    damp1_[voice] = damp;
+    damp2_[voice] = 1.0 - damp;
+
+    dirty_[voice] = false;
+}
+
+void FreeVerbBank::updateDirty() {
+    for (unsigned int v = 0; v < voices_; v++) {
+        if (dirty_[v]) {
+            update(v);
+        }
+    }
+    anyDirty_ = false;
+}
+
+void FreeVerbBank::clear() {
+    arena_.clear();
+    combFilter_.clear();
+}
+
+void FreeVerbBank::clear(unsigned int voice) {
+    const FreeVerb::DelayLine *lines[] = { combDelayL_, combDelayR_, allPassDelayL_, allPassDelayR_ };
+    const int counts[] = { FreeVerb::numCombs, FreeVerb::numCombs, FreeVerb::numAllPasses, FreeVerb::numAllPasses };
+    for (int k = 0; k < 4; k++) {
+        for (int i = 0; i < counts[k]; i++) {
+            StkFloat *ring = arena_.data() + lines[k][i].offset + voice;
+            for (unsigned int p = 0; p < lines[k][i].length; p++) {
+                ring[p * voices_] = 0.0;
+            }
+        }
+    }
+
+    for (int i = 0; i < 2 * FreeVerb::numCombs; i++) {
+        combFilter_[i * voices_ + voice] = 0.0;
+    }
+}
+
+void FreeVerbBank::process(const float* const* inL, const float* const* inR,
+                           float* const* outL, float* const* outR, size_t n) {
+    processBlock(inL, inR, outL, outR, n);
+}
+
+void FreeVerbBank::process(const StkFloat* const* inL, const StkFloat* const* inR,
+                           StkFloat* const* outL, StkFloat* const* outR, size_t n) {
+    processBlock(inL, inR, outL, outR, n);
+}
+
+// run frames x voices samples through one comb line, adding its output to sum
+static inline void combLine(StkFloat* arena, FreeVerb::DelayLine& line, size_t voices, const StkFloat* input,
+                            StkFloat* sum, StkFloat* state, size_t frames, const StkFloat* roomSize,
+                            const StkFloat* damp1, const StkFloat* damp2) {
+    size_t run = std::min(frames, (size_t) (line.length - line.index));
+    FreeVerbSimd::combLanes(arena + line.offset + line.index * voices, input, sum, state,
+                            voices, run, roomSize, damp1, damp2);
+    if (run < frames) {
+        FreeVerbSimd::combLanes(arena + line.offset, input + run * voices, sum + run * voices, state,
+                                voices, frames - run, roomSize, damp1, damp2);
+    }
+
+    advanceDelay(line, frames);
+}
+
+// run frames x voices samples through one allpass line in place
+static inline void allPassLine(StkFloat* arena, FreeVerb::DelayLine& line, size_t voices, StkFloat* x,
+                               size_t frames, StkFloat g) {
+    size_t run = std::min(frames, (size_t) (line.length - line.index));
+    FreeVerbSimd::allPass(x, arena + line.offset + line.index * voices, run * voices, g);
+    if (run < frames) {
+        FreeVerbSimd::allPass(x + run * voices, arena + line.offset, (frames - run) * voices, g);
+    }
+
+    advanceDelay(line, frames);
+}
+
+template <typename Sample>
+void FreeVerbBank::processBlock(const Sample* const* inL, const Sample* const* inR,
+                                Sample* const* outL, Sample* const* outR, size_t n) {
+    // parameter changes since the last block take effect here, all at once
+    if (anyDirty_) {
+        updateDirty();
+    }
+
+    const size_t V = voices_;
+    const StkFloat g = 0.5;     // allpass coefficient, as in FreeVerb
+    StkFloat *arena = arena_.data();
+    StkFloat *input = input_.data();
+    StkFloat *sumL = sumL_.data();
+    StkFloat *sumR = sumR_.data();
+    StkFloat *combFilter = combFilter_.data();
+
+    for (size_t done = 0; done < n; ) {
+        size_t frames = std::min(n - done, chunk_);
+
+        // gain, turning each voice's input into a column of the frames x voices block
+        for (size_t v = 0; v < V; v++) {
+            const Sample *l = inL[v] + done;
+            const Sample *r = (inR && inR[v]) ? inR[v] + done : l;
+            const StkFloat gain = gain_[v];
+            for (size_t t = 0; t < frames; t++) {
+                input[t * V + v] = ((StkFloat) l[t] + (StkFloat) r[t]) * gain;
+            }
+        }
+
+        std::fill(sumL, sumL + frames * V, 0.0);
+        std::fill(sumR, sumR + frames * V, 0.0);
+
+        // 8 LBCF filters in parallel per channel, vectorized across voices
+        for (int i = 0; i < FreeVerb::numCombs; i++) {
+            combLine(arena, combDelayL_[i], V, input, sumL, combFilter + i * V, frames,
+                     roomSize_.data(), damp1_.data(), damp2_.data());
+            combLine(arena, combDelayR_[i], V, input, sumR, combFilter + (FreeVerb::numCombs + i) * V, frames,
+                     roomSize_.data(), damp1_.data(), damp2_.data());
+        }
+
+        // 4 allpass filters in series, vectorized across frames and voices
+        for (int i = 0; i < FreeVerb::numAllPasses; i++) {
+            allPassLine(arena, allPassDelayL_[i], V, sumL, frames, g);
+            allPassLine(arena, allPassDelayR_[i], V, sumR, frames, g);
+        }
+
+        // mix output
+        for (size_t v = 0; v < V; v++) {
+            const Sample *l = inL[v] + done;
+            const Sample *r = (inR && inR[v]) ? inR[v] + done : l;
+            Sample *oL = outL[v] + done;
+            Sample *oR = (outR && outR[v]) ? outR[v] + done : NULL;
+            const StkFloat wet1 = wet1_[v], wet2 = wet2_[v], dry = dry_[v];
+            for (size_t t = 0; t < frames; t++) {
+                StkFloat yL = sumL[t * V + v]*wet1 + sumR[t * V + v]*wet2 + l[t]*dry;
+                StkFloat yR = sumR[t * V + v]*wet1 + sumL[t * V + v]*wet2 + r[t]*dry;
+
+                // hard limiter, as in FreeVerb
+                oL[t] = (Sample) limit(yL);
+                if (oR) {
+                    oR[t] = (Sample) limit(yR);
+                }
+            }
+        }
+
+        done += frames;
+    }
+}
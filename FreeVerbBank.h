@@ -0,0 +1,138 @@
+#ifndef STK_FREEVERBBANK_H
+#define STK_FREEVERBBANK_H
+
+#include "FreeVerb.h"
+#include "AlignedBuffer.h"
+#include <cstddef>
+
+namespace stk {
+
+/**************************************************************************/
+/*! \class FreeVerbBank
+    \brief Many independent FreeVerb reverbs processed together
+
+    Holds the state of a number of FreeVerb voices in struct-of-arrays
+    form: every delay line stores one lane per voice at each position,
+    so one step of a comb or allpass filter for all voices is a single
+    contiguous run of memory and is vectorized across voices. Each voice
+    has its own effect mix, room size, damping, width and freeze mode,
+    mapped exactly as in FreeVerb, and sounds the same as a FreeVerb
+    with those settings.
+*/
+/***************************************************************************/
+
+class FreeVerbBank : public Stk
+{
+    public:
+        //! Create a bank of the given number of voices with FreeVerb's default parameters
+        FreeVerbBank(unsigned int voices);
+
+        //! Destructor
+        ~FreeVerbBank();
+
+        //! returns the number of voices
+        unsigned int voices() const { return voices_; }
+
+        //! set the effect mix [0,1] of a voice
+        void setMix(unsigned int voice, StkFloat value);
+
+        //! get the effect mix of a voice
+        StkFloat getMix(unsigned int voice);
+
+        //! set the room size parameter [0,1] of a voice
+        void setRoomSize(unsigned int voice, StkFloat value);
+
+        //! get the room size parameter of a voice
+        StkFloat getRoomSize(unsigned int voice);
+
+        //! set the damping parameter [0,1] of a voice
+        void setDamp(unsigned int voice, StkFloat value);
+
+        //! get the damping parameter of a voice
+        StkFloat getDamp(unsigned int voice);
+
+        //! set the width parameter [0,1] of a voice
+        void setWidth(unsigned int voice, StkFloat value);
+
+        //! get the width parameter of a voice
+        StkFloat getWidth(unsigned int voice);
+
+        //! set the mode of a voice, frozen or not
+        void setMode(unsigned int voice, bool isFrozen);
+
+        //! get the freeze mode of a voice
+        bool getMode(unsigned int voice);
+
+        //! set every parameter of a voice in one step
+        void setParameters(unsigned int voice, const FreeVerb::Parameters& parameters);
+
+        //! get every parameter of a voice
+        FreeVerb::Parameters getParameters(unsigned int voice);
+
+        //! clears the delay lines of every voice
+        void clear();
+
+        //! clears the delay lines of one voice
+        void clear(unsigned int voice);
+
+        //! Process a block of planar audio for every voice
+        /*!
+          Each argument is an array with one buffer per voice. inR may be
+          NULL, or hold NULL entries, for voices with mono input, which then
+          feeds both channels. outR may be NULL if only left outputs are wanted.
+        */
+        void process(const float* const* inL, const float* const* inR,
+                     float* const* outL, float* const* outR, size_t n);
+
+        //! Process a block of planar audio for every voice in StkFloat precision
+        void process(const StkFloat* const* inL, const StkFloat* const* inR,
+                     StkFloat* const* outL, StkFloat* const* outR, size_t n);
+
+    protected:
+        // keep the derived per voice values in sync, as FreeVerb::update() does
+        void update(unsigned int voice);
+
+        // setters only mark their voice, which is updated at the next block
+        void markDirty(unsigned int voice) {
+            dirty_[voice] = true;
+            anyDirty_ = true;
+        }
+
+        // update every marked voice
+        void updateDirty();
+
+        template <typename Sample>
+        void processBlock(const Sample* const* inL, const Sample* const* inR,
+                          Sample* const* outL, Sample* const* outR, size_t n);
+
+        unsigned int voices_;
+
+        // per voice parameters, one entry per voice
+        AlignedBuffer<StkFloat> mix_;
+        AlignedBuffer<StkFloat> roomSizeMem_, roomSize_;
+        AlignedBuffer<StkFloat> dampMem_, damp1_, damp2_;
+        AlignedBuffer<StkFloat> width_;
+        AlignedBuffer<StkFloat> gain_;
+        AlignedBuffer<StkFloat> wet1_, wet2_, dry_;
+        AlignedBuffer<bool> frozenMode_;
+        AlignedBuffer<bool> dirty_;
+        bool anyDirty_;
+
+        // every delay line, each position holding one sample per voice
+        AlignedBuffer<StkFloat> arena_;
+        FreeVerb::DelayLine combDelayL_[FreeVerb::numCombs];
+        FreeVerb::DelayLine combDelayR_[FreeVerb::numCombs];
+        FreeVerb::DelayLine allPassDelayL_[FreeVerb::numAllPasses];
+        FreeVerb::DelayLine allPassDelayR_[FreeVerb::numAllPasses];
+
+        // comb lowpass states, numCombs left lines then numCombs right lines, voices each
+        AlignedBuffer<StkFloat> combFilter_;
+
+        // frames x voices scratch for the comb input and the two channel sums
+        AlignedBuffer<StkFloat> input_, sumL_, sumR_;
+        size_t chunk_;
+};
+
+}
+
+#endif
@@ -0,0 +1,346 @@
+/**************************************************************************/
+/*! \class FreeVerbFixed
+    \brief FreeVerb in fixed point, for integer audio pipelines
+
+    The same network as FreeVerb, 8 lowpass-feedback-comb-filters in
+    parallel per channel followed by 4 Schroeder allpass filters in
+    series, in saturating integer arithmetic on Q15 or Q31 audio with
+    int16_t delay lines.
+*/
+/***************************************************************************/
+
+#include "FreeVerbFixed.h"
+#include "FreeVerbLines.h"
+#include <math.h>
+#include <algorithm>
+
+using namespace stk;
+
+// fractional bits the wet signal carries below the allpass lines' samples
+static const int wetBits = 8;
+
+// the comb outputs are summed into the wet signal at the allpass lines' scale
+static const int combToWet = wetBits + FreeVerbFixed::combHeadroom - FreeVerbFixed::allPassHeadroom;
+
+// Q15 coefficient of a gain in [0,1], one being 32768
+static inline int32_t toQ15(StkFloat x) {
+    return (int32_t) floor(x * 32768.0 + 0.5);
+}
+
+static inline int32_t toQ31(int16_t x) {
+    return (int32_t) x * 65536;
+}
+
+static inline int32_t toQ31(int32_t x) {
+    return x;
+}
+
+// drop the low bits of a value, rounding to nearest
+static inline int64_t roundShift(int64_t x, int bits) {
+    return (x + ((int64_t) 1 << (bits - 1))) >> bits;
+}
+
+static inline int16_t saturate16(int64_t x) {
+    return (int16_t) std::min<int64_t>(std::max<int64_t>(x, -32768), 32767);
+}
+
+static inline int32_t saturate32(int64_t x) {
+    return (int32_t) std::min<int64_t>(std::max<int64_t>(x, INT32_MIN), INT32_MAX);
+}
+
+// an output sample from a Q46 sum, saturating as FreeVerb's limiter clips
+static inline void fromQ46(int64_t y, int16_t& out) {
+    out = saturate16(roundShift(y, 31));
+}
+
+static inline void fromQ46(int64_t y, int32_t& out) {
+    out = saturate32(roundShift(y, 15));
+}
+
+FreeVerbFixed::FreeVerbFixed() {
+    // same defaults as FreeVerb
+    setParameters(FreeVerb::Parameters());
+    update();
+    layoutDelayLines();
+}
+
+FreeVerbFixed::~FreeVerbFixed() {}
+
+void FreeVerbFixed::setMix(StkFloat value) {
+    if (value < 0.0) {
+        oStream_ << "FreeVerbFixed::setMix: mix parameter is less than zero ... setting to zero!";
+        handleError(StkError::WARNING);
+        value = 0.0;
+    }
+    else if (value > 1.0) {
+        oStream_ << "FreeVerbFixed::setMix: mix parameter is greater than one ... setting to one!";
+        handleError(StkError::WARNING);
+        value = 1.0;
+    }
+
+    mix_ = value;
+    dirty_ = true;
+}
+
+StkFloat FreeVerbFixed::getMix() {
+    return mix_;
+}
+
+void FreeVerbFixed::setRoomSize(StkFloat value) {
+    roomSizeMem_ = (value * FreeVerb::scaleRoom) + FreeVerb::offsetRoom;
+    dirty_ = true;
+}
+
+StkFloat FreeVerbFixed::getRoomSize() {
+    return (roomSizeMem_ - FreeVerb::offsetRoom) / FreeVerb::scaleRoom;
+}
+
+void FreeVerbFixed::setDamp(StkFloat value) {
+    dampMem_ = value * FreeVerb::scaleDamp;
+    dirty_ = true;
+}
+
+StkFloat FreeVerbFixed::getDamp() {
+    return dampMem_ / FreeVerb::scaleDamp;
+}
+
+void FreeVerbFixed::setWidth(StkFloat value) {
+    width_ = value;
+    dirty_ = true;
+}
+
+StkFloat FreeVerbFixed::getWidth() {
+    return width_;
+}
+
+void FreeVerbFixed::setMode(bool isFrozen) {
+    frozenMode_ = isFrozen;
+    dirty_ = true;
+}
+
+bool FreeVerbFixed::getMode() {
+    return frozenMode_;
+}
+
+void FreeVerbFixed::setParameters(const FreeVerb::Parameters& parameters) {
+    setMix(parameters.mix);
+    roomSizeMem_ = (parameters.roomSize * FreeVerb::scaleRoom) + FreeVerb::offsetRoom;
+    dampMem_ = parameters.damp * FreeVerb::scaleDamp;
+    width_ = parameters.width;
+    frozenMode_ = parameters.frozen;
+    dirty_ = true;
+}
+
+FreeVerb::Parameters FreeVerbFixed::getParameters() {
+    FreeVerb::Parameters parameters;
+    parameters.mix = mix_;
+    parameters.roomSize = getRoomSize();
+    parameters.damp = getDamp();
+    parameters.width = width_;
+    parameters.frozen = frozenMode_;
+    return parameters;
+}
+
+void FreeVerbFixed::update() {
+    StkFloat wet = FreeVerb::scaleWet * mix_;
+    StkFloat dry = FreeVerb::scaleDry * (1.0 - mix_);
+
+    // same L1 normalization as FreeVerb::update()
+    wet /= (wet + dry);
+    dry /= (wet + dry);
+
+    wet1_ = toQ15(wet * (width_/2.0 + 0.5));
+    wet2_ = toQ15(wet * (1.0 - width_)/2.0);
+    dry_ = toQ15(dry);
+
+    StkFloat roomSize = roomSizeMem_;
+    StkFloat damp = dampMem_;
+    StkFloat gain = FreeVerb::fixedGain;
+    if (frozenMode_) {
+        roomSize = 1.0;
+        damp = 0.0;
+        gain = 0.0;
+    }
+
+    // the lowpass coefficients sum to exactly one, so the comb states
+    // never leave the range of the samples they filter
+    roomSize_ = toQ15(roomSize);
+    damp1_ = toQ15(damp);
+    damp2_ = 32768 - damp1_;
+
+    // from a sum of two Q31 inputs to Q31 of the comb lines' range
+    gain_ = (int64_t) floor(gain * 4294967296.0 / (1 << combHeadroom) + 0.5);
+
+    dirty_ = false;
+}
+
+void FreeVerbFixed::layoutDelayLines() {
+    // delay line lengths as FreeVerb uses them at the current sampling rate
+    FreeVerb::DelayLengths lengths = FreeVerb::delayLengths(Stk::sampleRate());
+
+    size_t arenaSize = 0;
+    for (int i = 0; i < FreeVerb::numCombs; i++) {
+        arenaSize = placeDelayLine<int16_t>(combDelay_[i], lengths.comb[i], arenaSize);
+        arenaSize = placeDelayLine<int16_t>(combDelay_[FreeVerb::numCombs + i], lengths.comb[i] + FreeVerb::stereoSpread,
+                                            arenaSize);
+        combFilter_[i] = 0;
+        combFilter_[FreeVerb::numCombs + i] = 0;
+        combError_[i] = 0;
+        combError_[FreeVerb::numCombs + i] = 0;
+    }
+    for (int i = 0; i < FreeVerb::numAllPasses; i++) {
+        arenaSize = placeDelayLine<int16_t>(allPassDelay_[i], lengths.allPass[i], arenaSize);
+        arenaSize = placeDelayLine<int16_t>(allPassDelay_[FreeVerb::numAllPasses + i],
+                                            lengths.allPass[i] + FreeVerb::stereoSpread, arenaSize);
+    }
+    arena_.resize(arenaSize);
+
+    // a chunk must be shorter than every delay line, as in FreeVerb
+    chunk_ = FreeVerb::maxChunk;
+    for (int i = 0; i < FreeVerb::numCombs; i++) {
+        chunk_ = std::min(chunk_, (size_t) lengths.comb[i]);
+    }
+    for (int i = 0; i < FreeVerb::numAllPasses; i++) {
+        chunk_ = std::min(chunk_, (size_t) lengths.allPass[i]);
+    }
+}
+
+void FreeVerbFixed::clear() {
+    arena_.clear();
+    std::fill(combFilter_, combFilter_ + 2 * FreeVerb::numCombs, 0);
+    std::fill(combError_, combError_ + 2 * FreeVerb::numCombs, 0);
+}
+
+void FreeVerbFixed::process(const int16_t* inL, const int16_t* inR, int16_t* outL, int16_t* outR, size_t n) {
+    processBlock(inL, inR, outL, outR, n);
+}
+
+void FreeVerbFixed::process(const int32_t* inL, const int32_t* inR, int32_t* outL, int32_t* outR, size_t n) {
+    processBlock(inL, inR, outL, outR, n);
+}
+
+// write one lane of comb outputs back into its delay line, add them to
+// the wet signal and advance the line
+static inline void writeCombDelay(int16_t* ring, FreeVerb::DelayLine& line, const int16_t* src,
+                                  size_t stride, int32_t* sum, size_t frames) {
+    size_t run = std::min(frames, (size_t) (line.length - line.index));
+    int16_t *dst = ring + line.index;
+    for (size_t t = 0; t < run; t++, src += stride) {
+        dst[t] = *src;
+        sum[t] += (int32_t) *src * (1 << combToWet);
+    }
+
+    // wrap around to the start of the ring
+    sum += run;
+    for (size_t t = 0; t < frames - run; t++, src += stride) {
+        ring[t] = *src;
+        sum[t] += (int32_t) *src * (1 << combToWet);
+    }
+
+    advanceDelay(line, frames);
+}
+
+// FreeVerb's allpass, out = -vn + (1 + g) * vn_m, written as vn_m - in
+static inline void allPass(int32_t* x, int16_t* delay, size_t frames, int32_t g) {
+    for (size_t t = 0; t < frames; t++) {
+        int32_t vn_m = (int32_t) delay[t] * (1 << wetBits);
+        int64_t vn = x[t] + roundShift((int64_t) g * vn_m, 15);
+        delay[t] = saturate16(roundShift(vn, wetBits));
+        x[t] = vn_m - x[t];
+    }
+}
+
+// run frames through one allpass line in place and advance it
+static inline void allPassDelay(int32_t* x, int16_t* ring, FreeVerb::DelayLine& line, size_t frames, int32_t g) {
+    size_t run = std::min(frames, (size_t) (line.length - line.index));
+    allPass(x, ring + line.index, run, g);
+    if (run < frames) {
+        allPass(x + run, ring, frames - run, g);
+    }
+
+    advanceDelay(line, frames);
+}
+
+template <typename Sample>
+void FreeVerbFixed::processBlock(const Sample* inL, const Sample* inR, Sample* outL, Sample* outR, size_t n) {
+    // parameter changes since the last block take effect here, all at once
+    if (dirty_) {
+        update();
+    }
+
+    // mono input feeds both channels
+    if (!inR) {
+        inR = inL;
+    }
+
+    const size_t lanes = 2 * FreeVerb::numCombs;
+    const int32_t g = 16384;    // allpass coefficient 0.5, as in FreeVerb
+    int16_t *arena = arena_.data();
+    int32_t in[FreeVerb::maxChunk];
+    int16_t combs[FreeVerb::maxChunk * 2 * FreeVerb::numCombs];
+    int32_t wetL[FreeVerb::maxChunk];
+    int32_t wetR[FreeVerb::maxChunk];
+
+    for (size_t done = 0; done < n; ) {
+        size_t frames = std::min(n - done, chunk_);
+
+        // gain
+        for (size_t t = 0; t < frames; t++) {
+            int64_t x = (int64_t) toQ31(inL[done + t]) + toQ31(inR[done + t]);
+            in[t] = saturate32(roundShift(x * gain_, 32));
+        }
+
+        // 8 LBCF filters in parallel per channel, one comb per lane
+        for (size_t i = 0; i < lanes; i++) {
+            readDelay(combs + i, lanes, arena + combDelay_[i].offset, combDelay_[i], frames);
+        }
+
+        // each comb carries the rounding error of a sample into its next
+        // one, moving the rounding noise up out of the band the lowpass
+        // keeps circulating, where it would build up as the room grows
+        int32_t *state = combFilter_;
+        int32_t *error = combError_;
+        for (size_t t = 0; t < frames; t++) {
+            int16_t *row = combs + t * lanes;
+            for (size_t i = 0; i < lanes; i++) {
+                int64_t x = (int64_t) row[i] * 65536;
+                state[i] = (int32_t) roundShift(damp2_ * x + (int64_t) damp1_ * state[i], 15);
+                int64_t y = in[t] + roundShift((int64_t) roomSize_ * state[i], 15) + error[i];
+                row[i] = saturate16(roundShift(y, 16));
+
+                // no more than half a step is carried when the line saturates
+                error[i] = (int32_t) std::min<int64_t>(std::max<int64_t>(y - row[i] * (int64_t) 65536, -32768), 32768);
+            }
+        }
+
+        std::fill(wetL, wetL + frames, 0);
+        std::fill(wetR, wetR + frames, 0);
+        for (int i = 0; i < FreeVerb::numCombs; i++) {
+            const int j = FreeVerb::numCombs + i;
+            writeCombDelay(arena + combDelay_[i].offset, combDelay_[i], combs + i, lanes, wetL, frames);
+            writeCombDelay(arena + combDelay_[j].offset, combDelay_[j], combs + j, lanes, wetR, frames);
+        }
+
+        // 4 allpass filters in series
+        for (int i = 0; i < FreeVerb::numAllPasses; i++) {
+            const int j = FreeVerb::numAllPasses + i;
+            allPassDelay(wetL, arena + allPassDelay_[i].offset, allPassDelay_[i], frames, g);
+            allPassDelay(wetR, arena + allPassDelay_[j].offset, allPassDelay_[j], frames, g);
+        }
+
+        // mix output in Q46, the wet signal lifted from its lines' range
+        const int wetToQ46 = 46 - 15 - wetBits - 15 + allPassHeadroom;
+        for (size_t t = 0; t < frames; t++) {
+            int64_t xL = toQ31(inL[done + t]);
+            int64_t xR = toQ31(inR[done + t]);
+            int64_t yL = ((int64_t) wetL[t]*wet1_ + (int64_t) wetR[t]*wet2_) * (1 << wetToQ46) + xL*dry_;
+            int64_t yR = ((int64_t) wetR[t]*wet1_ + (int64_t) wetL[t]*wet2_) * (1 << wetToQ46) + xR*dry_;
+            fromQ46(yL, outL[done + t]);
+            if (outR) {
+                fromQ46(yR, outR[done + t]);
+            }
+        }
+
+        done += frames;
+    }
+}
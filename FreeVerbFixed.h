@@ -0,0 +1,146 @@
+#ifndef STK_FREEVERBFIXED_H
+#define STK_FREEVERBFIXED_H
+
+#include "FreeVerb.h"
+#include "AlignedBuffer.h"
+#include <cstddef>
+#include <stdint.h>
+
+namespace stk {
+
+/**************************************************************************/
+/*! \class FreeVerbFixed
+    \brief FreeVerb in fixed point, for integer audio pipelines
+
+    The same network as FreeVerb, 8 lowpass-feedback-comb-filters in
+    parallel per channel followed by 4 Schroeder allpass filters in
+    series, with the same delay lengths, stereo spread, input gain
+    (FreeVerb::fixedGain) and parameter mapping (scaleRoom, offsetRoom,
+    scaleDamp, scaleWet, scaleDry), run in integer arithmetic on Q15
+    (int16_t) or Q31 (int32_t) audio, as STK_SINT16 and STK_SINT32 hold
+    it.
+
+    Every delay line holds int16_t samples, a quarter of FreeVerb's
+    memory. The comb lines span full scale, which FreeVerb's combs reach
+    only when driven near their resonance by a full scale input, and the
+    allpass lines 2 bits more, as the sum of the combs they carry can
+    run to several times full scale before the limiter. The comb lowpass
+    states are kept in 32 bits, coefficients and gains in Q15 and
+    products in 64 bits. Every store to a delay line and every output
+    saturates, the last taking the place of FreeVerb's hard limiter.
+    Freeze mode holds, with a feedback of one and no damping the combs
+    recirculate their samples unchanged. Integers have no denormals, so
+    no strategy for them is needed. There is no parameter smoothing,
+    bypass or economy mode.
+
+    Error bound: against FreeVerb on the same input, measured on noise
+    and tone bursts peaking at -6 dBFS and below over the whole range of
+    room size, damping and mix, the difference stays below -60 dBFS RMS
+    and -45 dBFS peak, and below -67 dBFS RMS for room sizes up to 0.5.
+    It is the rounding of the comb lines to 16 bits, so it does not fall
+    with the input level and grows with the comb feedback. Q15 output
+    adds its own rounding. Hotter input can saturate the delay lines,
+    where FreeVerb lets its network run above full scale and clips only
+    the output.
+*/
+/***************************************************************************/
+
+class FreeVerbFixed : public Stk
+{
+    public:
+        //! Create a reverb with FreeVerb's defaults
+        FreeVerbFixed();
+
+        //! Destructor
+        ~FreeVerbFixed();
+
+        //! set the effect mix [0,1]
+        void setMix(StkFloat value);
+
+        //! get the effect mix
+        StkFloat getMix();
+
+        //! set the room size parameter [0,1]
+        void setRoomSize(StkFloat value);
+
+        //! get the room size parameter
+        StkFloat getRoomSize();
+
+        //! set the damping parameter [0,1]
+        void setDamp(StkFloat value);
+
+        //! get the damping parameter
+        StkFloat getDamp();
+
+        //! set the width parameter [0,1]
+        void setWidth(StkFloat value);
+
+        //! get the width parameter
+        StkFloat getWidth();
+
+        //! set the mode, frozen or not
+        void setMode(bool isFrozen);
+
+        //! get the freeze mode
+        bool getMode();
+
+        //! set every parameter in one step
+        void setParameters(const FreeVerb::Parameters& parameters);
+
+        //! get every parameter
+        FreeVerb::Parameters getParameters();
+
+        //! clears the delay lines
+        void clear();
+
+        //! Process a block of planar Q15 audio
+        /*!
+          As FreeVerb::process(): pass inR = NULL for mono input, which
+          feeds both channels, and outR = NULL if only the left output is
+          wanted. Input and output buffers may be the same.
+        */
+        void process(const int16_t* inL, const int16_t* inR, int16_t* outL, int16_t* outR, size_t n);
+
+        //! Process a block of planar Q31 audio
+        void process(const int32_t* inL, const int32_t* inR, int32_t* outL, int32_t* outR, size_t n);
+
+        static const int combHeadroom = 0;      // bits above full scale in the comb delay lines
+        static const int allPassHeadroom = 2;   // bits above full scale in the allpass delay lines
+
+    protected:
+        // keep the fixed point coefficients in sync, as FreeVerb::update() does
+        void update();
+
+        // size and place every delay line for the current sampling rate
+        void layoutDelayLines();
+
+        template <typename Sample>
+        void processBlock(const Sample* inL, const Sample* inR, Sample* outL, Sample* outR, size_t n);
+
+        StkFloat mix_;
+        StkFloat roomSizeMem_;
+        StkFloat dampMem_;
+        StkFloat width_;
+        bool frozenMode_;
+        bool dirty_;
+
+        // Q15 coefficients and gains, and the input gain in Q32
+        int32_t roomSize_, damp1_, damp2_;
+        int32_t wet1_, wet2_, dry_;
+        int64_t gain_;
+
+        // every delay line, left channel lines first
+        AlignedBuffer<int16_t> arena_;
+        FreeVerb::DelayLine combDelay_[2 * FreeVerb::numCombs];
+        FreeVerb::DelayLine allPassDelay_[2 * FreeVerb::numAllPasses];
+
+        // comb lowpass states, Q31 of the comb lines' range
+        int32_t combFilter_[2 * FreeVerb::numCombs];
+        int32_t combError_[2 * FreeVerb::numCombs];
+
+        size_t chunk_;
+};
+
+}
+
+#endif
@@ -2,8 +2,8 @@
 
 #include "Skini.h"
 #include "SKINI.msg"
-#include "Envelope.h"
 #include "../FreeVerb.h"
+#include "../Mailbox.h"
 #include "Messager.h"
 #include "RtAudio.h"
 
@@ -12,16 +12,22 @@
 #include <cstring>
 #include <iostream>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 
 using namespace stk;
 
-// default sample frames between control input checks
-#define DELTA_CONTROL_TICKS 64
+// milliseconds the control thread waits between checks for input
+#define CONTROL_PERIOD_MS 5
+
+// change in the envelope gain per frame as it opens or closes
+#define ENVELOPE_RATE 0.001
 
 void usage(void) {
     // Error function in case of incorrect command-line argument specifications
     std::cout << std::endl << "usage: effects flags" << std::endl;
     std::cout << "\twhere flag = -s RATE to specify a sample rate," << std::endl;
+    std::cout << "\tflag = -b FRAMES to specify the audio buffer size," << std::endl;
     std::cout << "\tflag = -ip for realtime SKINI input by pipe" << std::endl;
     std::cout << "\t\t(won't work under Win95/98)," << std::endl;
     std::cout << "\tand flag = -is <port> for realtime SKINI input by socket." << std::endl;
@@ -29,6 +35,7 @@ void usage(void) {
 }
 
 bool done;
+volatile sig_atomic_t dumpRequested = 0;
 /*
  * Interrupt handler
  */
@@ -36,141 +43,293 @@ static void finish(int ignore) {
     done = true;
 }
 
+/*
+ * Statistics dump handler, the dump itself happens on the control thread
+ */
+static void requestDump(int ignore) {
+    dumpRequested = 1;
+}
+
+/*
+ The Controls structure holds every setting the control messages
+ change. The control thread posts the whole of it to the audio
+ callback, which applies it between blocks. The defaults are those
+ of FreeVerb and of a closed envelope.
+*/
+struct Controls {
+    Controls()
+    : envelopeTarget(0.0), messages(0) {}
+
+    FreeVerbFloat::Parameters reverb;
+    StkFloat envelopeTarget;
+
+    // messages handled so far, for the callback statistics
+    unsigned long messages;
+};
+
+/*
+ The CallbackStats class counts what happens in the audio callback.
+ Only the callback writes to it, and every count is atomic, so any
+ other thread can read it at any time without locking.
+*/
+class CallbackStats {
+    public:
+        // callback time as a share of the buffer deadline, in tenths,
+        // then the last two for up to twice the deadline and beyond
+        static const int loadBuckets = 12;
+
+        // control messages a callback took in, 0 to 3 and then 4 or more
+        static const int messageBuckets = 5;
+
+        CallbackStats() {
+            callbacks_ = 0;
+            worstLoad_ = 0.0;
+            for (int i = 0; i < loadBuckets; i++) {
+                load_[i] = 0;
+            }
+            for (int i = 0; i < messageBuckets; i++) {
+                messages_[i] = 0;
+            }
+            inputOverflows_ = 0;
+            outputUnderflows_ = 0;
+            clips_[0] = 0;
+            clips_[1] = 0;
+        }
+
+        // a callback that took load of its deadline, applied messages and reported status
+        void record(double load, unsigned long messages, RtAudioStreamStatus status) {
+            add(callbacks_, 1);
+            add(load_[std::min((int) (load * 10.0), 10) + (load > 2.0)], 1);
+            if (load > worstLoad_.load(std::memory_order_relaxed)) {
+                worstLoad_.store(load, std::memory_order_relaxed);
+            }
+            add(messages_[std::min(messages, (unsigned long) messageBuckets - 1)], 1);
+            if (status & RTAUDIO_INPUT_OVERFLOW) {
+                add(inputOverflows_, 1);
+            }
+            if (status & RTAUDIO_OUTPUT_UNDERFLOW) {
+                add(outputUnderflows_, 1);
+            }
+        }
+
+        // the limiter's running clip count for a channel
+        void setClips(unsigned int channel, unsigned long clips) {
+            clips_[channel].store(clips, std::memory_order_relaxed);
+        }
+
+        void dump(std::ostream& out) {
+            out << std::endl << "callbacks: " << callbacks_.load(std::memory_order_relaxed) << std::endl;
+            out << "time against the deadline:" << std::endl;
+            for (int i = 0; i < loadBuckets; i++) {
+                if (i < 10) {
+                    out << "  " << i * 10 << "-" << (i + 1) * 10 << "%: ";
+                }
+                else {
+                    out << "  " << (i == 10 ? "100-200%: " : ">200%: ");
+                }
+                out << load_[i].load(std::memory_order_relaxed) << std::endl;
+            }
+            out << "  worst: " << worstLoad_.load(std::memory_order_relaxed) * 100.0 << "%" << std::endl;
+            out << "control messages per callback:" << std::endl;
+            for (int i = 0; i < messageBuckets; i++) {
+                out << "  " << i << (i == messageBuckets - 1 ? "+" : "") << ": "
+                    << messages_[i].load(std::memory_order_relaxed) << std::endl;
+            }
+            out << "input overflows: " << inputOverflows_.load(std::memory_order_relaxed) << std::endl;
+            out << "output underflows: " << outputUnderflows_.load(std::memory_order_relaxed) << std::endl;
+            out << "limiter clips: left " << clips_[0].load(std::memory_order_relaxed)
+                << ", right " << clips_[1].load(std::memory_order_relaxed) << std::endl;
+        }
+
+    private:
+        // only one thread writes, so a plain load and store will do, without a locked add
+        static void add(std::atomic<unsigned long>& count, unsigned long n) {
+            count.store(count.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+
+        std::atomic<unsigned long> callbacks_;
+        std::atomic<unsigned long> load_[loadBuckets];
+        std::atomic<double> worstLoad_;
+        std::atomic<unsigned long> messages_[messageBuckets];
+        std::atomic<unsigned long> inputOverflows_;
+        std::atomic<unsigned long> outputUnderflows_;
+        std::atomic<unsigned long> clips_[2];
+};
+
+/*
+ The GainRamp class is the envelope on the output. Like an STK
+ Envelope it moves its gain toward the target by a fixed rate per
+ frame, but it works out each frame's gain from its position in the
+ buffer rather than by stepping, so the multiply runs as a vector
+ loop over the interleaved frames, and once the target is reached the
+ rest of the buffer is scaled by a constant or, fully open, left as
+ it is.
+*/
+class GainRamp {
+    public:
+        GainRamp()
+        : value_(0.0), target_(0.0), rate_(0.0) {}
+
+        void setRate(StkFloat rate) { rate_ = rate; }
+
+        void setTarget(StkFloat target) { target_ = target; }
+
+        // scale n interleaved frames of the given number of channels
+        void apply(float* frames, unsigned int channels, size_t n) {
+            size_t ramp = 0;
+            if (value_ != target_) {
+                // the frames before the one that reaches the target
+                StkFloat distance = fabs(target_ - value_);
+                ramp = distance >= rate_ * n ? n : (size_t) (distance / rate_);
+                const StkFloat step = target_ > value_ ? rate_ : -rate_;
+                const float start = (float) value_, delta = (float) step;
+                for (size_t i = 0; i < ramp; i++) {
+                    const float gain = start + delta * (float) (i + 1);
+                    for (unsigned int c = 0; c < channels; c++) {
+                        frames[i * channels + c] *= gain;
+                    }
+                }
+                value_ = ramp < n ? target_ : value_ + step * ramp;
+            }
+            if (ramp < n && value_ != 1.0) {
+                const float gain = (float) value_;
+                float *rest = frames + ramp * channels, *end = frames + n * channels;
+                for (; rest < end; rest++) {
+                    *rest *= gain;
+                }
+            }
+        }
+
+    private:
+        StkFloat value_, target_, rate_;
+};
+
 /*
  The TickData structure holds all the class instances and data that
  are shared by the various processing functions.
 */
 class TickData {
     public:
-        TickData()
-        : counter(0), haveMessage(false) {}
-
-        FreeVerb freerev;
-        Envelope envelope;
+        FreeVerbFloat freerev;
+        GainRamp envelope;
         Messager messager;
         Skini::Message message;
-        StkFloat lastSample;
-  
-        int counter;
-        bool haveMessage;
+
+        // control thread to audio callback
+        Mailbox<Controls> mailbox;
+
+        // the controls the audio callback last applied
+        Controls controls;
+
+        // written by the audio callback, read by the control thread
+        CallbackStats stats;
 };
 
 /*
  * The processMessage() function encapsulates the handling of control
- * messages.  It can be easily relocated within a program structure
- * depending on the desired scheduling scheme.
+ * messages.  It runs on the control thread and only updates the
+ * given controls, which are then posted to the audio callback.
  */
-void processMessage(TickData* data) {
-    register unsigned int msgID = data->message.intValues[0];
-    register StkFloat valueMIDI = data->message.floatValues[1];
+void processMessage(const Skini::Message& message, Controls& controls) {
+    register unsigned int msgID = message.intValues[0];
+    register StkFloat valueMIDI = message.floatValues[1];
     register StkFloat value = valueMIDI * ONE_OVER_128;
 
-    switch(data->message.type) {
+    switch(message.type) {
         case __SK_Exit_:
-            data->envelope.setTarget(0.0);
+            controls.envelopeTarget = 0.0;
             done = true;
             return;
         case __SK_NoteOn_:
             if (valueMIDI == 0.0) {
                 // really a NoteOff
-                data->envelope.setTarget(0.0);
+                controls.envelopeTarget = 0.0;
             }
             else {
                 // a NoteOn
-                data->envelope.setTarget(1.0);
+                controls.envelopeTarget = 1.0;
             }
             break;
         case __SK_NoteOff_:
-            data->envelope.setTarget(0.0);
+            controls.envelopeTarget = 0.0;
             break;
         case __SK_ControlChange_:
             switch (msgID) {
                 case 22: 
                     // parameter room size change
-                    data->freerev.setRoomSize(value);
+                    controls.reverb.roomSize = value;
                     break;
                 case 23:
                     // parameter damping change
-                    data->freerev.setDamp(value);
+                    controls.reverb.damp = value;
                     break;
                 case 24:
                     // parameter width change
-                    data->freerev.setWidth(value);
+                    controls.reverb.width = value;
                     break;
                 case 25:
                     // parameter freeze mode change
-                    value = floor(value + 0.5);
-                    if (value) {
-                        data->freerev.setMode(true);
-                    }
-                    else {
-                        data->freerev.setMode(false);
-                    }
+                    controls.reverb.frozen = floor(value + 0.5) != 0.0;
                     break;
                 case 44:
                     // parameter effect mix change
-                    data->freerev.setMix(value);
+                    controls.reverb.mix = value;
                     break; 
             }
     }
+}
 
-    data->haveMessage = false;
-    return;
+/*
+ * The applyControls() function brings the reverb and envelope in line
+ * with newly posted controls. It runs in the audio callback, before a
+ * block is processed; the reverb works out its changes once, as that
+ * block starts.
+ */
+void applyControls(TickData* data, const Controls& controls) {
+    data->freerev.setParameters(controls.reverb);
+    if (controls.envelopeTarget != data->controls.envelopeTarget) {
+        data->envelope.setTarget(controls.envelopeTarget);
+    }
+    data->controls = controls;
 }
 
 /*
- * The tick() function handles sample computation and scheduling of
- * control updates.  It will be called automatically by RtAudio when
- * the system needs a new buffer of audio samples.
+ * The tick() function handles sample computation.  It will be called
+ * automatically by RtAudio when the system needs a new buffer of audio
+ * samples.  Controls posted since the last buffer are applied once,
+ * before any of it is computed.  The reverb reads the device's input
+ * buffer and writes its output buffer in place, and the envelope is
+ * then applied to the output as one gain ramp.
  */
 int tick(void *outputBuffer, void *inputBuffer, unsigned int nBufferFrames,
          double streamTime, RtAudioStreamStatus status, void *dataPointer) {
     TickData *data = (TickData *) dataPointer;
-    register StkFloat *oSamples = (StkFloat *) outputBuffer, *iSamples = (StkFloat *) inputBuffer;
-    Effect *effect;
+    float *oSamples = (float *) outputBuffer, *iSamples = (float *) inputBuffer;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
-    int counter, nTicks = (int) nBufferFrames;
-    while (nTicks > 0 && !done) {
-        if (!data->haveMessage) {
-            data->messager.popMessage(data->message);
-            if (data->message.type > 0) {
-                data->counter = (long) (data->message.time * Stk::sampleRate());
-                data->haveMessage = true;
-            }
-            else {
-                data->counter = DELTA_CONTROL_TICKS;
-            }
-        }
-
-        counter = std::min(nTicks, data->counter);
-        data->counter -= counter;
-        for (int i = 0; i < counter; i++) {
-            data->freerev.tick(*iSamples++);
-            effect = (Effect *) &(data->freerev);
-            const StkFrames& samples = effect->lastFrame();
-            *oSamples++ = data->envelope.tick() * samples[0];
-            *oSamples++ = data->envelope.lastOut() * samples[1];
-            nTicks--;
-        }
+    Controls controls;
+    unsigned long messages = 0;
+    if (data->mailbox.read(controls)) {
+        messages = controls.messages - data->controls.messages;
+        applyControls(data, controls);
+    }
 
-        if (nTicks == 0) {
-            break;
-        }
+    data->freerev.processInterleaved(iSamples, 1, oSamples, 2, nBufferFrames);
+    data->envelope.apply(oSamples, 2, nBufferFrames);
 
-        // Process control messages.
-        if (data->haveMessage) {
-            processMessage(data);
-        }
-  }
+    data->stats.setClips(0, data->freerev.getClipCount(0));
+    data->stats.setClips(1, data->freerev.getClipCount(1));
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    data->stats.record(elapsed.count() * Stk::sampleRate() / nBufferFrames, messages, status);
 
-  return 0;
+    return 0;
 }
 
 int main(int argc, char *argv[]) {
     TickData data;
     RtAudio adac;
 
-    if (argc < 2 || argc > 6) {
+    if (argc < 2 || argc > 8) {
         usage();
     }
 
@@ -181,6 +340,7 @@ int main(int argc, char *argv[]) {
 
     // Parse the command-line arguments.
     unsigned int port = 2001;
+    unsigned int bufferFrames = RT_BUFFER_SIZE;
     for (int i = 1; i < argc; i++) {
         if (!strcmp(argv[i], "-is")) {
             if (i+1 < argc && argv[i+1][0] != '-') {
@@ -194,19 +354,22 @@ int main(int argc, char *argv[]) {
         else if (!strcmp(argv[i], "-s") && (i+1 < argc) && argv[i+1][0] != '-') {
             Stk::setSampleRate(atoi(argv[++i]));
         }
+        else if (!strcmp(argv[i], "-b") && (i+1 < argc) && argv[i+1][0] != '-') {
+            bufferFrames = atoi(argv[++i]);
+        }
         else {
             usage();
         }
     }
 
     // Allocate the adac here.
-    RtAudioFormat format = (sizeof(StkFloat) == 8) ? RTAUDIO_FLOAT64 : RTAUDIO_FLOAT32;
+    // the float reverb works on the device buffers directly
+    RtAudioFormat format = RTAUDIO_FLOAT32;
     RtAudio::StreamParameters oparameters, iparameters;
     oparameters.deviceId = adac.getDefaultOutputDevice();
     oparameters.nChannels = 2;
     iparameters.deviceId = adac.getDefaultInputDevice();
     iparameters.nChannels = 1;
-    unsigned int bufferFrames = RT_BUFFER_SIZE;
     try {
         adac.openStream(&oparameters, &iparameters, format, (unsigned int)Stk::sampleRate(), &bufferFrames, &tick, (void *)&data);
     }
@@ -215,10 +378,17 @@ int main(int argc, char *argv[]) {
         goto cleanup;
     }
 
-    data.envelope.setRate(0.001);
+    data.envelope.setRate(ENVELOPE_RATE);
+
+    // controls arrive once per buffer, glide to them rather than stepping
+    data.freerev.setSmoothing(0.02);
 
     // Install an interrupt handler function.
 	(void) signal( SIGINT, finish );
+#if defined(SIGUSR1)
+    // and one to print the callback statistics while running
+    (void) signal( SIGUSR1, requestDump );
+#endif
 
     // If realtime output, set our callback function and start the dac.
     try {
@@ -230,9 +400,36 @@ int main(int argc, char *argv[]) {
     }
 
     // Setup finished.
-    // Periodically check "done" status.
-    while (!done) {
-        Stk::sleep( 50 );
+    // Handle control messages here, away from the audio callback, posting
+    // the controls once for every batch of messages, until "done".
+    {
+        Controls controls;
+        while (!done) {
+            bool changed = false;
+            data.messager.popMessage(data.message);
+            while (data.message.type > 0 && !done) {
+                // a message may ask to be delayed
+                if (data.message.time > 0.0) {
+                    if (changed) {
+                        data.mailbox.write(controls);
+                        changed = false;
+                    }
+                    Stk::sleep((unsigned long) (data.message.time * 1000.0));
+                }
+                processMessage(data.message, controls);
+                controls.messages++;
+                changed = true;
+                data.messager.popMessage(data.message);
+            }
+            if (changed) {
+                data.mailbox.write(controls);
+            }
+            if (dumpRequested) {
+                dumpRequested = 0;
+                data.stats.dump(std::cout);
+            }
+            Stk::sleep(CONTROL_PERIOD_MS);
+        }
     }
 
     // Shut down the output stream.
@@ -243,6 +440,8 @@ int main(int argc, char *argv[]) {
         error.printMessage();
     }
 
+    data.stats.dump(std::cout);
+
     cleanup:
 	    std::cout << std::endl << "effects finished ... goodbye." << std::endl;
 
@@ -0,0 +1,123 @@
+#ifndef STK_FREEVERBLINES_H
+#define STK_FREEVERBLINES_H
+
+#include "Stk.h"
+#include "AlignedBuffer.h"
+#include <algorithm>
+#include <cstddef>
+
+namespace stk {
+
+/**************************************************************************/
+/*! \file FreeVerbLines.h
+    \brief Delay line helpers shared by the FreeVerb classes
+
+    FreeVerb, FreeVerbMulti, FreeVerbBank and FreeVerbFixed all keep
+    their delay lines as rings in one aligned arena, each described by a
+    FreeVerb::DelayLine. These place such lines and move blocks of
+    samples in and out of them, and hold FreeVerb's output limiter, so
+    that every class handles them the same way. Only the FreeVerb
+    sources include this header.
+*/
+/***************************************************************************/
+
+// place a delay line of lanes interleaved rings at the end of an arena of
+// Sample, returns the new arena size
+template <typename Sample, typename Line>
+inline size_t placeDelayLine(Line& line, unsigned int length, size_t arenaSize, size_t lanes = 1) {
+    line.offset = arenaSize;
+    line.length = length;
+    line.index = 0;
+    line.stale = false;
+
+    // start the next line on a fresh cache line
+    const size_t lineSamples = AlignedBuffer<Sample>::alignment / sizeof(Sample);
+    return arenaSize + (length * lanes + lineSamples - 1) / lineSamples * lineSamples;
+}
+
+// move a delay line on by frames, it is no longer stale once it wraps
+template <typename Line>
+inline void advanceDelay(Line& line, size_t frames) {
+    line.index += frames;
+    if (line.index >= line.length) {
+        line.index -= line.length;
+        line.stale = false;
+    }
+}
+
+// copy the next frames outputs of a delay line to dst with the given stride
+template <typename Sample, typename Line>
+inline void readDelay(Sample* dst, size_t stride, const Sample* ring, const Line& line, size_t frames) {
+    size_t run = std::min(frames, (size_t) (line.length - line.index));
+    const Sample *src = ring + line.index;
+    if (line.stale) {
+        // not yet written since clear()
+        for (size_t t = 0; t < run; t++, dst += stride) {
+            *dst = Sample(0);
+        }
+    }
+    else {
+        for (size_t t = 0; t < run; t++, dst += stride) {
+            *dst = src[t];
+        }
+    }
+
+    // wrap around to the start of the ring
+    for (size_t t = 0; t < frames - run; t++, dst += stride) {
+        *dst = ring[t];
+    }
+}
+
+// write the next frames inputs of a delay line from src with the given stride
+// and advance the line
+template <typename Sample, typename Line>
+inline void writeDelay(Sample* ring, Line& line, const Sample* src, size_t stride, size_t frames) {
+    size_t run = std::min(frames, (size_t) (line.length - line.index));
+    Sample *dst = ring + line.index;
+    for (size_t t = 0; t < run; t++, src += stride) {
+        dst[t] = *src;
+    }
+
+    // wrap around to the start of the ring
+    for (size_t t = 0; t < frames - run; t++, src += stride) {
+        ring[t] = *src;
+    }
+
+    advanceDelay(line, frames);
+}
+
+// the same, also adding the inputs to sum
+template <typename Sample, typename Line>
+inline void writeDelay(Sample* ring, Line& line, const Sample* src, size_t stride, Sample* sum, size_t frames) {
+    size_t run = std::min(frames, (size_t) (line.length - line.index));
+    Sample *dst = ring + line.index;
+    for (size_t t = 0; t < run; t++, src += stride) {
+        dst[t] = *src;
+        sum[t] += *src;
+    }
+
+    // wrap around to the start of the ring
+    sum += run;
+    for (size_t t = 0; t < frames - run; t++, src += stride) {
+        ring[t] = *src;
+        sum[t] += *src;
+    }
+
+    advanceDelay(line, frames);
+}
+
+// hard limiter
+// there's not much else we can do at this point
+inline StkFloat limit(StkFloat y) {
+    if (y >= 1.0) {
+        y = 0.9999;
+    }
+    if (y <= -1.0) {
+        y = -0.9999;
+    }
+    return y;
+}
+
+}
+
+#endif
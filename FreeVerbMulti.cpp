@@ -0,0 +1,374 @@
+/**************************************************************************/
+/*! \class FreeVerbMulti
+    \brief FreeVerb with any number of output channels
+
+    A FreeVerb for surround and ambisonic beds. The comb bank is shared:
+    FreeVerb's left and right sets of 8 combs run as the lanes of one
+    comb bank kernel call, fed by the sum of every input channel, and
+    every output channel takes a sum of one set's combs with its own
+    pattern of signs (rows of an 8 x 8 Hadamard matrix), so that up to
+    16 channels get mutually uncorrelated sums. Each channel then has
+    its own 4 allpasses, lengthened from FreeVerb's by that channel's
+    entry in a spread table, as FreeVerb lengthens its right channel by
+    stereoSpread. The combs are most of FreeVerb's work, so a 7.1 bed
+    costs little more than one stereo FreeVerb.
+
+    The wet signals are mixed into the outputs by an N x N matrix. By
+    default it is built from the width, generalizing FreeVerb's wet1 and
+    wet2: each output takes its own channel's wet signal plus an equal
+    share of all of them as the width falls, and with two channels it
+    holds FreeVerb's wet1 and wet2. Any other matrix may be set instead.
+*/
+/***************************************************************************/
+
+#include "FreeVerbMulti.h"
+#include "FreeVerbSimd.h"
+#include "FreeVerbLines.h"
+#include <math.h>
+#include <algorithm>
+
+using namespace stk;
+
+
+// sign of comb i in the sum taken by Hadamard row r
+static inline StkFloat hadamard(unsigned int r, unsigned int i) {
+    bool odd = false;
+    for (unsigned int bits = r & i; bits; bits &= bits - 1) {
+        odd = !odd;
+    }
+    return odd ? -1.0 : 1.0;
+}
+
+FreeVerbMulti::FreeVerbMulti(unsigned int channels)
+    : channels_(channels), matrix_(channels * channels), spread_(channels),
+      combSets_(channels > 1 ? 2 : 1), allPassDelay_(FreeVerb::numAllPasses * channels) {
+    // same defaults as FreeVerb
+    setParameters(FreeVerb::Parameters());
+    update();
+
+    for (unsigned int c = 0; c < channels_; c++) {
+        spread_[c] = c * FreeVerb::stereoSpread;
+    }
+    layoutDelayLines();
+}
+
+FreeVerbMulti::~FreeVerbMulti() {}
+
+void FreeVerbMulti::setMix(StkFloat value) {
+    if (value < 0.0) {
+        oStream_ << "FreeVerbMulti::setMix: mix parameter is less than zero ... setting to zero!";
+        handleError(StkError::WARNING);
+        value = 0.0;
+    }
+    else if (value > 1.0) {
+        oStream_ << "FreeVerbMulti::setMix: mix parameter is greater than one ... setting to one!";
+        handleError(StkError::WARNING);
+        value = 1.0;
+    }
+
+    mix_ = value;
+    dirty_ = true;
+}
+
+StkFloat FreeVerbMulti::getMix() {
+    return mix_;
+}
+
+void FreeVerbMulti::setRoomSize(StkFloat value) {
+    roomSizeMem_ = (value * FreeVerb::scaleRoom) + FreeVerb::offsetRoom;
+    dirty_ = true;
+}
+
+StkFloat FreeVerbMulti::getRoomSize() {
+    return (roomSizeMem_ - FreeVerb::offsetRoom) / FreeVerb::scaleRoom;
+}
+
+void FreeVerbMulti::setDamp(StkFloat value) {
+    dampMem_ = value * FreeVerb::scaleDamp;
+    dirty_ = true;
+}
+
+StkFloat FreeVerbMulti::getDamp() {
+    return dampMem_ / FreeVerb::scaleDamp;
+}
+
+void FreeVerbMulti::setWidth(StkFloat value) {
+    width_ = value;
+
+    // each output keeps width of its own channel and shares the rest
+    // equally; with two channels these are wet1 and wet2 before the mix
+    const StkFloat share = (1.0 - width_) / channels_;
+    for (unsigned int i = 0; i < channels_; i++) {
+        for (unsigned int j = 0; j < channels_; j++) {
+            matrix_[i * channels_ + j] = (i == j) ? width_ + share : share;
+        }
+    }
+    uniform_ = true;
+}
+
+StkFloat FreeVerbMulti::getWidth() {
+    return width_;
+}
+
+void FreeVerbMulti::setMode(bool isFrozen) {
+    frozenMode_ = isFrozen;
+    dirty_ = true;
+}
+
+bool FreeVerbMulti::getMode() {
+    return frozenMode_;
+}
+
+void FreeVerbMulti::setParameters(const FreeVerb::Parameters& parameters) {
+    setMix(parameters.mix);
+    roomSizeMem_ = (parameters.roomSize * FreeVerb::scaleRoom) + FreeVerb::offsetRoom;
+    dampMem_ = parameters.damp * FreeVerb::scaleDamp;
+    setWidth(parameters.width);
+    frozenMode_ = parameters.frozen;
+    dirty_ = true;
+}
+
+FreeVerb::Parameters FreeVerbMulti::getParameters() {
+    FreeVerb::Parameters parameters;
+    parameters.mix = mix_;
+    parameters.roomSize = getRoomSize();
+    parameters.damp = getDamp();
+    parameters.width = width_;
+    parameters.frozen = frozenMode_;
+    return parameters;
+}
+
+void FreeVerbMulti::setSpread(const unsigned int* spread) {
+    for (unsigned int c = 0; c < channels_; c++) {
+        spread_[c] = spread[c];
+    }
+    layoutDelayLines();
+}
+
+unsigned int FreeVerbMulti::getSpread(unsigned int channel) {
+    return spread_[channel];
+}
+
+void FreeVerbMulti::setMatrix(const StkFloat* matrix) {
+    for (unsigned int i = 0; i < channels_ * channels_; i++) {
+        matrix_[i] = matrix[i];
+    }
+    uniform_ = false;
+}
+
+StkFloat FreeVerbMulti::getMatrix(unsigned int out, unsigned int in) {
+    return matrix_[out * channels_ + in];
+}
+
+void FreeVerbMulti::update() {
+    StkFloat wet = FreeVerb::scaleWet * mix_;
+    dry_ = FreeVerb::scaleDry * (1.0 - mix_);
+
+    // same L1 normalization as FreeVerb::update()
+    wet /= (wet + dry_);
+    dry_ /= (wet + dry_);
+    wet_ = wet;
+
+    if (frozenMode_) {
+        roomSize_ = 1.0;
+        damp_ = 0.0;
+        gain_ = 0.0;
+    }
+    else {
+        roomSize_ = roomSizeMem_;
+        damp_ = dampMem_;
+        gain_ = FreeVerb::fixedGain;
+    }
+
+    dirty_ = false;
+}
+
+void FreeVerbMulti::layoutDelayLines() {
+    // delay line lengths as FreeVerb uses them at the current sampling rate
+    FreeVerb::DelayLengths lengths = FreeVerb::delayLengths(Stk::sampleRate());
+
+    size_t arenaSize = 0;
+    for (unsigned int k = 0; k < combSets_; k++) {
+        for (int i = 0; i < FreeVerb::numCombs; i++) {
+            arenaSize = placeDelayLine<StkFloat>(combDelay_[k * FreeVerb::numCombs + i], lengths.comb[i] + spread_[k], arenaSize);
+            combFilter_[k * FreeVerb::numCombs + i] = 0.0;
+        }
+    }
+    for (unsigned int c = 0; c < channels_; c++) {
+        for (int i = 0; i < FreeVerb::numAllPasses; i++) {
+            arenaSize = placeDelayLine<StkFloat>(allPassDelay_[c * FreeVerb::numAllPasses + i], lengths.allPass[i] + spread_[c],
+                                                 arenaSize);
+        }
+    }
+    arena_.resize(arenaSize);
+
+    // a chunk must be shorter than every delay line, as in FreeVerb
+    chunk_ = FreeVerb::maxChunk;
+    for (int i = 0; i < FreeVerb::numCombs; i++) {
+        chunk_ = std::min(chunk_, (size_t) lengths.comb[i]);
+    }
+    for (int i = 0; i < FreeVerb::numAllPasses; i++) {
+        chunk_ = std::min(chunk_, (size_t) lengths.allPass[i]);
+    }
+
+    wetSignal_.resize(chunk_ * channels_);
+}
+
+void FreeVerbMulti::clear() {
+    arena_.clear();
+    std::fill(combFilter_, combFilter_ + 2 * FreeVerb::numCombs, 0.0);
+}
+
+void FreeVerbMulti::process(const float* const* input, float* const* output, size_t n) {
+    processBlock(input, output, n);
+}
+
+void FreeVerbMulti::process(const StkFloat* const* input, StkFloat* const* output, size_t n) {
+    processBlock(input, output, n);
+}
+
+// run frames through one allpass line in place
+static inline void allPassDelay(StkFloat* x, StkFloat* ring, FreeVerb::DelayLine& line,
+                                size_t frames, StkFloat g, bool undenormalize) {
+    size_t run = std::min(frames, (size_t) (line.length - line.index));
+    FreeVerbSimd::allPass(x, ring + line.index, run, g, undenormalize);
+    if (run < frames) {
+        FreeVerbSimd::allPass(x + run, ring, frames - run, g, undenormalize);
+    }
+
+    advanceDelay(line, frames);
+}
+
+template <typename Sample>
+void FreeVerbMulti::processBlock(const Sample* const* input, Sample* const* output, size_t n) {
+    // parameter changes since the last block take effect here, all at once
+    if (dirty_) {
+        update();
+    }
+
+    const size_t C = channels_;
+    const size_t lanes = FreeVerb::numCombs * combSets_;
+    const StkFloat g = 0.5;     // allpass coefficient, as in FreeVerb
+    StkFloat *arena = arena_.data();
+    StkFloat *wet = wetSignal_.data();
+    StkFloat in[FreeVerb::maxChunk];
+    StkFloat combs[FreeVerb::maxChunk * 2 * FreeVerb::numCombs];
+
+    // denormals are flushed for the whole block where the CPU can, as FreeVerb does by default
+    FreeVerbSimd::DenormalGuard guard;
+    const bool undenormalize = !FreeVerbSimd::canFlushDenormals();
+
+    // the width's matrix is a diagonal plus a share of the sum of every channel
+    const StkFloat own = wet_ * width_;
+    const StkFloat share = wet_ * (1.0 - width_) / C;
+
+    for (size_t done = 0; done < n; ) {
+        size_t frames = std::min(n - done, chunk_);
+
+        // gain, every input channel summed into one comb input
+        std::fill(in, in + frames, 0.0);
+        for (size_t c = 0; c < C; c++) {
+            if (input[c]) {
+                const Sample *x = input[c] + done;
+                for (size_t t = 0; t < frames; t++) {
+                    in[t] += (StkFloat) x[t];
+                }
+            }
+        }
+        for (size_t t = 0; t < frames; t++) {
+            in[t] *= gain_;
+        }
+
+        // both comb sets, one comb per lane, in a single kernel call
+        for (size_t i = 0; i < lanes; i++) {
+            readDelay(combs + i, lanes, arena + combDelay_[i].offset, combDelay_[i], frames);
+        }
+
+        FreeVerbSimd::combBank(combs, in, combFilter_, lanes, frames, roomSize_, damp_, 1.0 - damp_,
+                               undenormalize);
+
+        for (size_t i = 0; i < lanes; i++) {
+            writeDelay(arena + combDelay_[i].offset, combDelay_[i], combs + i, lanes, frames);
+        }
+
+        // channels alternate between the sets, taking the next Hadamard row
+        // each time round; row 0 is the plain sum FreeVerb takes
+        for (size_t c = 0; c < C; c++) {
+            const StkFloat *set = combs + (c % combSets_) * FreeVerb::numCombs;
+            const unsigned int row = (unsigned int) (c / combSets_) % FreeVerb::numCombs;
+            StkFloat sign[FreeVerb::numCombs];
+            for (int i = 0; i < FreeVerb::numCombs; i++) {
+                sign[i] = hadamard(row, i);
+            }
+
+            StkFloat *w = wet + c * frames;
+            for (size_t t = 0; t < frames; t++) {
+                const StkFloat *x = set + t * lanes;
+                StkFloat y = 0.0;
+                for (int i = 0; i < FreeVerb::numCombs; i++) {
+                    y += sign[i] * x[i];
+                }
+                w[t] = y;
+            }
+        }
+
+        // 4 allpass filters in series per channel
+        for (size_t c = 0; c < C; c++) {
+            for (int i = 0; i < FreeVerb::numAllPasses; i++) {
+                FreeVerb::DelayLine &line = allPassDelay_[c * FreeVerb::numAllPasses + i];
+                allPassDelay(wet + c * frames, arena + line.offset, line, frames, g, undenormalize);
+            }
+        }
+
+        // the sum of every wet channel, for the width's matrix
+        StkFloat sum[FreeVerb::maxChunk];
+        if (uniform_) {
+            std::fill(sum, sum + frames, 0.0);
+            for (size_t c = 0; c < C; c++) {
+                for (size_t t = 0; t < frames; t++) {
+                    sum[t] += wet[c * frames + t];
+                }
+            }
+        }
+
+        // mix output
+        for (size_t c = 0; c < C; c++) {
+            if (!output[c]) {
+                continue;
+            }
+
+            StkFloat y[FreeVerb::maxChunk];
+            if (uniform_) {
+                for (size_t t = 0; t < frames; t++) {
+                    y[t] = wet[c * frames + t]*own + sum[t]*share;
+                }
+            }
+            else {
+                std::fill(y, y + frames, 0.0);
+                for (size_t j = 0; j < C; j++) {
+                    const StkFloat gain = wet_ * matrix_[c * C + j];
+                    if (gain != 0.0) {
+                        for (size_t t = 0; t < frames; t++) {
+                            y[t] += wet[j * frames + t]*gain;
+                        }
+                    }
+                }
+            }
+
+            if (input[c]) {
+                const Sample *x = input[c] + done;
+                for (size_t t = 0; t < frames; t++) {
+                    y[t] += x[t]*dry_;
+                }
+            }
+
+            // hard limiter, as in FreeVerb
+            Sample *out = output[c] + done;
+            for (size_t t = 0; t < frames; t++) {
+                out[t] = (Sample) limit(y[t]);
+            }
+        }
+
+        done += frames;
+    }
+}
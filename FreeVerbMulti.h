@@ -0,0 +1,166 @@
+#ifndef STK_FREEVERBMULTI_H
+#define STK_FREEVERBMULTI_H
+
+#include "FreeVerb.h"
+#include "AlignedBuffer.h"
+#include <cstddef>
+
+namespace stk {
+
+/**************************************************************************/
+/*! \class FreeVerbMulti
+    \brief FreeVerb with any number of output channels
+
+    A FreeVerb for surround and ambisonic beds. The comb bank is shared:
+    FreeVerb's left and right sets of 8 combs run as the lanes of one
+    comb bank kernel call, fed by the sum of every input channel, and
+    every output channel takes a sum of one set's combs with its own
+    pattern of signs (rows of an 8 x 8 Hadamard matrix), so that up to
+    16 channels get mutually uncorrelated sums. Each channel then has
+    its own 4 allpasses, lengthened from FreeVerb's by that channel's
+    entry in a spread table, as FreeVerb lengthens its right channel by
+    stereoSpread. The combs are most of FreeVerb's work, so a 7.1 bed
+    costs little more than one stereo FreeVerb.
+
+    The wet signals are mixed into the outputs by an N x N matrix. By
+    default it is built from the width, generalizing FreeVerb's wet1 and
+    wet2: each output takes its own channel's wet signal plus an equal
+    share of all of them as the width falls, and with two channels it
+    holds FreeVerb's wet1 and wet2. Any other matrix may be set instead.
+*/
+/***************************************************************************/
+
+class FreeVerbMulti : public Stk
+{
+    public:
+        //! Create a reverb with the given number of output channels and FreeVerb's defaults
+        /*!
+          The spread of channel c starts out as c * FreeVerb::stereoSpread.
+        */
+        FreeVerbMulti(unsigned int channels);
+
+        //! Destructor
+        ~FreeVerbMulti();
+
+        //! returns the number of channels
+        unsigned int channels() const { return channels_; }
+
+        //! set the effect mix [0,1]
+        void setMix(StkFloat value);
+
+        //! get the effect mix
+        StkFloat getMix();
+
+        //! set the room size parameter [0,1]
+        void setRoomSize(StkFloat value);
+
+        //! get the room size parameter
+        StkFloat getRoomSize();
+
+        //! set the damping parameter [0,1]
+        void setDamp(StkFloat value);
+
+        //! get the damping parameter
+        StkFloat getDamp();
+
+        //! set the width parameter [0,1], which replaces the wet matrix with the one it implies
+        void setWidth(StkFloat value);
+
+        //! get the width parameter
+        StkFloat getWidth();
+
+        //! set the mode, frozen or not
+        void setMode(bool isFrozen);
+
+        //! get the freeze mode
+        bool getMode();
+
+        //! set every parameter in one step
+        void setParameters(const FreeVerb::Parameters& parameters);
+
+        //! get every parameter
+        FreeVerb::Parameters getParameters();
+
+        //! set the delay, in samples, added to the allpasses of each channel
+        /*!
+          spread holds one entry per channel. The first two entries also
+          lengthen the left and right comb sets. Reallocates and clears
+          the delay lines.
+        */
+        void setSpread(const unsigned int* spread);
+
+        //! get the spread of a channel
+        unsigned int getSpread(unsigned int channel);
+
+        //! set the wet mixing matrix
+        /*!
+          matrix holds channels x channels gains, one row per output, so
+          output i takes matrix[i * channels + j] of the wet signal of
+          channel j. The effect mix scales it as it scales wet1 and wet2.
+        */
+        void setMatrix(const StkFloat* matrix);
+
+        //! get the gain from the wet signal of channel in to output out
+        StkFloat getMatrix(unsigned int out, unsigned int in);
+
+        //! clears the delay lines
+        void clear();
+
+        //! Process a block of planar audio
+        /*!
+          input and output hold one buffer per channel. NULL input buffers
+          are silent, so a stereo source feeds a 7.1 bed through its first
+          two entries. Output buffers may be NULL for channels not wanted.
+        */
+        void process(const float* const* input, float* const* output, size_t n);
+
+        //! Process a block of planar audio in StkFloat precision
+        void process(const StkFloat* const* input, StkFloat* const* output, size_t n);
+
+    protected:
+        // keep the derived values in sync, as FreeVerb::update() does
+        void update();
+
+        // size and place every delay line for the spread table
+        void layoutDelayLines();
+
+        template <typename Sample>
+        void processBlock(const Sample* const* input, Sample* const* output, size_t n);
+
+        unsigned int channels_;
+
+        StkFloat mix_;
+        StkFloat roomSizeMem_, roomSize_;
+        StkFloat dampMem_, damp_;
+        StkFloat width_;
+        StkFloat gain_;
+        StkFloat wet_, dry_;
+        bool frozenMode_;
+        bool dirty_;
+
+        // channels x channels wet gains before the effect mix, and whether it
+        // is the width's, diagonal plus a constant, which mixes in O(channels)
+        AlignedBuffer<StkFloat> matrix_;
+        bool uniform_;
+
+        AlignedBuffer<unsigned int> spread_;
+
+        // comb sets, two, or one for a single channel
+        unsigned int combSets_;
+
+        // every delay line, numCombs per comb set and numAllPasses per channel
+        AlignedBuffer<StkFloat> arena_;
+        FreeVerb::DelayLine combDelay_[2 * FreeVerb::numCombs];
+        AlignedBuffer<FreeVerb::DelayLine> allPassDelay_;
+
+        // comb lowpass states, one per comb
+        StkFloat combFilter_[2 * FreeVerb::numCombs];
+
+        // the wet signal of each channel, a chunk each
+        AlignedBuffer<StkFloat> wetSignal_;
+        size_t chunk_;
+};
+
+}
+
+#endif
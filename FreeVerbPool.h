@@ -0,0 +1,114 @@
+#ifndef STK_FREEVERBPOOL_H
+#define STK_FREEVERBPOOL_H
+
+#include "FreeVerb.h"
+#include <atomic>
+#include <vector>
+#include <stdint.h>
+
+namespace stk {
+
+/**************************************************************************/
+/*! \class BasicFreeVerbPool
+    \brief Preallocated FreeVerb reverbs handed out from realtime threads
+
+    Every reverb, with its delay lines, is created when the pool is, so
+    a host can start reverbs for new voices or buses from its audio
+    thread without allocating. The reverbs themselves sit in one
+    allocation and are handed out and back through a lock-free stack of
+    free indices, each in O(1). The head of the stack carries a count of
+    its changes alongside the index, so a reverb taken and returned by
+    another thread between the read and the swap of the head is caught.
+
+    acquire() resets the reverb it hands out to the pool's parameters,
+    with no smoothing, bypass or wet-only output, and clears it.
+    Changing a pooled reverb's decimation reallocates its delay lines,
+    so set it from a thread that may allocate.
+*/
+/***************************************************************************/
+
+template <typename T>
+class BasicFreeVerbPool
+{
+    public:
+        //! create size reverbs, each set to parameters when acquired
+        BasicFreeVerbPool(unsigned int size,
+                          const typename BasicFreeVerb<T>::Parameters& parameters = typename BasicFreeVerb<T>::Parameters())
+            : reverbs_(size), next_(size), parameters_(parameters) {
+            for (unsigned int i = 0; i < size; i++) {
+                next_[i].store(i + 1, std::memory_order_relaxed);
+            }
+            head_.store(0, std::memory_order_release);
+        }
+
+        //! returns the number of reverbs in the pool
+        unsigned int size() const { return (unsigned int) reverbs_.size(); }
+
+        //! take a free reverb, reset and cleared, or NULL if every one is in use
+        BasicFreeVerb<T>* acquire() {
+            const uint64_t empty = reverbs_.size();
+            uint64_t head = head_.load(std::memory_order_acquire);
+            uint64_t index;
+            for (;;) {
+                index = head & indexMask;
+                if (index == empty) {
+                    return NULL;
+                }
+                uint64_t next = next_[index].load(std::memory_order_relaxed);
+                if (head_.compare_exchange_weak(head, nextTag(head) | next,
+                                                std::memory_order_acq_rel, std::memory_order_acquire)) {
+                    break;
+                }
+            }
+
+            BasicFreeVerb<T> &reverb = reverbs_[index];
+            reverb.setParameters(parameters_);
+            reverb.setSmoothing(0.0);
+            reverb.setBypassLevel(0.0);
+            reverb.setWetOnly(false);
+            reverb.resetClipCounts();
+            reverb.clear();
+            return &reverb;
+        }
+
+        //! give back a reverb acquire() handed out
+        void release(BasicFreeVerb<T>* reverb) {
+            const uint64_t index = reverb - &reverbs_[0];
+            uint64_t head = head_.load(std::memory_order_relaxed);
+            do {
+                next_[index].store(head & indexMask, std::memory_order_relaxed);
+            } while (!head_.compare_exchange_weak(head, nextTag(head) | index,
+                                                  std::memory_order_release, std::memory_order_relaxed));
+        }
+
+    private:
+        BasicFreeVerbPool(const BasicFreeVerbPool&);
+        BasicFreeVerbPool& operator=(const BasicFreeVerbPool&);
+
+        // the head holds the index of the first free reverb in its low
+        // bits and the number of times it has changed in the high bits
+        static const uint64_t indexMask = 0xffffffff;
+
+        static uint64_t nextTag(uint64_t head) {
+            return (head & ~indexMask) + (indexMask + 1);
+        }
+
+        std::vector<BasicFreeVerb<T> > reverbs_;
+
+        // the free reverb after each free one, size() ending the list
+        std::vector<std::atomic<uint64_t> > next_;
+
+        typename BasicFreeVerb<T>::Parameters parameters_;
+
+        alignas(64) std::atomic<uint64_t> head_;
+};
+
+//! a pool of FreeVerb
+typedef BasicFreeVerbPool<StkFloat> FreeVerbPool;
+
+//! a pool of FreeVerbFloat
+typedef BasicFreeVerbPool<float> FreeVerbFloatPool;
+
+}
+
+#endif
@@ -0,0 +1,644 @@
+/**************************************************************************/
+/*! \class FreeVerbSimd
+    \brief Runtime-dispatched vector kernels for FreeVerb
+
+    The vector kernels are written once with GCC vector extensions and
+    instantiated for each register width and sample type inside a
+    function carrying the matching target attribute, so a single object
+    file holds every level and the choice is made at run time.
+*/
+/***************************************************************************/
+
+#include "FreeVerbSimd.h"
+#include "FreeVerb.h"
+#include <cstring>
+
+using namespace stk;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FREEVERB_SIMD_X86
+#endif
+
+#if defined(__GNUC__) && (defined(FREEVERB_SIMD_X86) || defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define FREEVERB_SIMD_VECTOR
+#endif
+
+// the scalar loops are also the remainders of the vector kernels, and are
+// forced inline so they build for the vector kernel's target rather than
+// being called from it with the upper halves of the AVX registers dirty
+#if defined(__GNUC__)
+#define FREEVERB_INLINE inline __attribute__((always_inline))
+#else
+#define FREEVERB_INLINE inline
+#endif
+
+// same constant as FreeVerb::undenormalize()
+static const StkFloat undenormal = 9.8607615E-32f;
+
+// FreeVerb::undenormalize() where the kernel is asked to, otherwise nothing
+template <bool U, typename T>
+static FREEVERB_INLINE T undenormalizeIf(T x) {
+    return U ? FreeVerb::undenormalize(x) : x;
+}
+
+// lanes first..lanes-1 of a frames x lanes block
+template <bool U, typename T>
+static FREEVERB_INLINE void combBankColumns(size_t first, T* x, const T* input, T* state, size_t lanes,
+                                            size_t frames, T roomSize, T damp1, T damp2) {
+    for (size_t lane = first; lane < lanes; lane++) {
+        T s = state[lane];
+        T *row = x + lane;
+        for (size_t t = 0; t < frames; t++, row += lanes) {
+            s = damp2 * undenormalizeIf<U>(*row) + damp1 * s;
+            *row = input[t] + (roomSize * undenormalizeIf<U>(s));
+        }
+        state[lane] = s;
+    }
+}
+
+template <bool U, typename T>
+static void combBankScalar(T* x, const T* input, T* state, size_t lanes,
+                           size_t frames, T roomSize, T damp1, T damp2) {
+    combBankColumns<U>(0, x, input, state, lanes, frames, roomSize, damp1, damp2);
+}
+
+// lanes first..lanes-1 of a frames x lanes block
+template <typename T>
+static FREEVERB_INLINE void combLanesColumns(size_t first, T* x, const T* input, T* sum, T* state,
+                                             size_t lanes, size_t frames, const T* roomSize,
+                                             const T* damp1, const T* damp2) {
+    for (size_t lane = first; lane < lanes; lane++) {
+        T s = state[lane];
+        for (size_t t = 0, i = lane; t < frames; t++, i += lanes) {
+            s = damp2[lane] * FreeVerb::undenormalize(x[i]) + damp1[lane] * s;
+            x[i] = input[i] + (roomSize[lane] * FreeVerb::undenormalize(s));
+            sum[i] += x[i];
+        }
+        state[lane] = s;
+    }
+}
+
+template <typename T>
+static void combLanesScalar(T* x, const T* input, T* sum, T* state,
+                            size_t lanes, size_t frames, const T* roomSize,
+                            const T* damp1, const T* damp2) {
+    combLanesColumns(0, x, input, sum, state, lanes, frames, roomSize, damp1, damp2);
+}
+
+// frames first..frames-1 of an allpass run
+template <bool U, typename T>
+static FREEVERB_INLINE void allPassFrames(size_t first, T* x, T* delay, size_t frames, T g) {
+    const T gOut = 1 + g;
+    for (size_t t = first; t < frames; t++) {
+        T vn_m = undenormalizeIf<U>(delay[t]);
+        T vn = x[t] + (g * vn_m);
+        delay[t] = vn;
+        x[t] = -vn + gOut*vn_m;
+    }
+}
+
+template <bool U, typename T>
+static void allPassScalar(T* x, T* delay, size_t frames, T g) {
+    allPassFrames<U>(0, x, delay, frames, g);
+}
+
+// outputs first..count-1 of a FIR run at the given step through its input
+template <typename T>
+static FREEVERB_INLINE void firOutputs(size_t first, T* output, const T* input, size_t step, size_t count,
+                                       const T* taps, size_t numTaps) {
+    for (size_t j = first; j < count; j++) {
+        const T *in = input + j * step;
+        T y = 0;
+        for (size_t k = 0; k < numTaps; k++) {
+            y += taps[k] * in[k];
+        }
+        output[j] = y;
+    }
+}
+
+template <typename T>
+static void firScalar(T* output, const T* input, size_t step, size_t count,
+                      const T* taps, size_t numTaps) {
+    firOutputs(0, output, input, step, count, taps, numTaps);
+}
+
+// the kernels in use for each sample type, switched by setLevel(),
+// the comb bank and allpass indexed by whether they undenormalize
+template <typename T>
+struct Kernels {
+    static void (*combBank[2])(T*, const T*, T*, size_t, size_t, T, T, T);
+    static void (*combLanes)(T*, const T*, T*, T*, size_t, size_t, const T*, const T*, const T*);
+    static void (*allPass[2])(T*, T*, size_t, T);
+    static void (*fir)(T*, const T*, size_t, size_t, const T*, size_t);
+};
+
+template <typename T>
+void (*Kernels<T>::combBank[2])(T*, const T*, T*, size_t, size_t, T, T, T) = {
+    combBankScalar<false, T>, combBankScalar<true, T>
+};
+
+template <typename T>
+void (*Kernels<T>::combLanes)(T*, const T*, T*, T*, size_t, size_t, const T*, const T*, const T*) = combLanesScalar<T>;
+
+template <typename T>
+void (*Kernels<T>::allPass[2])(T*, T*, size_t, T) = {
+    allPassScalar<false, T>, allPassScalar<true, T>
+};
+
+template <typename T>
+void (*Kernels<T>::fir)(T*, const T*, size_t, size_t, const T*, size_t) = firScalar<T>;
+
+#if defined(FREEVERB_SIMD_VECTOR)
+
+// vector registers of each width for each sample type
+template <typename T>
+struct Vectors;
+
+template <>
+struct Vectors<double> {
+    typedef double v128 __attribute__((vector_size(16)));
+    typedef double v256 __attribute__((vector_size(32)));
+    typedef double v512 __attribute__((vector_size(64)));
+};
+
+template <>
+struct Vectors<float> {
+    typedef float v128 __attribute__((vector_size(16)));
+    typedef float v256 __attribute__((vector_size(32)));
+    typedef float v512 __attribute__((vector_size(64)));
+};
+
+// vectors are passed by reference so the helpers have no ABI of their own
+template <typename V, typename T>
+static FREEVERB_INLINE void load(V& v, const T* p) {
+    std::memcpy(&v, p, sizeof(V));
+}
+
+template <typename V, typename T>
+static FREEVERB_INLINE void store(T* p, const V& v) {
+    std::memcpy(p, &v, sizeof(V));
+}
+
+template <typename V, typename T>
+static FREEVERB_INLINE void broadcast(V& v, T s) {
+    v = V() + s;
+}
+
+// vector form of FreeVerb::undenormalize(), without the volatile
+template <typename V>
+static FREEVERB_INLINE void undenormalize(V& v, const V& tiny) {
+    v = (v + tiny) - tiny;
+}
+
+// K comb lanes of width W at a time; independent recurrences hide the feedback latency
+template <bool U, typename T, typename V, int K>
+static FREEVERB_INLINE size_t combTiles(size_t lane, T* x, const T* input, T* state,
+                                        size_t lanes, size_t frames, const V& room, const V& d1,
+                                        const V& d2, const V& tiny) {
+    const size_t W = sizeof(V) / sizeof(T);
+    for (; lane + K*W <= lanes; lane += K*W) {
+        V s[K];
+        for (int k = 0; k < K; k++) {
+            load(s[k], state + lane + k*W);
+        }
+
+        T *row = x + lane;
+        for (size_t t = 0; t < frames; t++, row += lanes) {
+            V in;
+            broadcast(in, input[t]);
+            for (int k = 0; k < K; k++) {
+                V xn;
+                load(xn, row + k*W);
+                if (U) {
+                    undenormalize(xn, tiny);
+                }
+                s[k] = d2 * xn + d1 * s[k];
+
+                V yn = s[k];
+                if (U) {
+                    undenormalize(yn, tiny);
+                }
+                store(row + k*W, V(in + room * yn));
+            }
+        }
+
+        for (int k = 0; k < K; k++) {
+            store(state + lane + k*W, s[k]);
+        }
+    }
+
+    return lane;
+}
+
+template <bool U, typename T, typename V>
+static FREEVERB_INLINE void combBankVector(T* x, const T* input, T* state, size_t lanes,
+                                           size_t frames, T roomSize, T damp1, T damp2) {
+    V room, d1, d2, tiny;
+    broadcast(room, roomSize);
+    broadcast(d1, damp1);
+    broadcast(d2, damp2);
+    broadcast(tiny, (T) undenormal);
+
+    size_t lane = combTiles<U, T, V, 4>(0, x, input, state, lanes, frames, room, d1, d2, tiny);
+    lane = combTiles<U, T, V, 2>(lane, x, input, state, lanes, frames, room, d1, d2, tiny);
+    lane = combTiles<U, T, V, 1>(lane, x, input, state, lanes, frames, room, d1, d2, tiny);
+    combBankColumns<U>(lane, x, input, state, lanes, frames, roomSize, damp1, damp2);
+}
+
+// K lanes of width W at a time, each with its own input and parameters
+template <typename T, typename V, int K>
+static FREEVERB_INLINE size_t combLaneTiles(size_t lane, T* x, const T* input, T* sum,
+                                            T* state, size_t lanes, size_t frames,
+                                            const T* roomSize, const T* damp1,
+                                            const T* damp2, const V& tiny) {
+    const size_t W = sizeof(V) / sizeof(T);
+    for (; lane + K*W <= lanes; lane += K*W) {
+        V s[K], room[K], d1[K], d2[K];
+        for (int k = 0; k < K; k++) {
+            load(s[k], state + lane + k*W);
+            load(room[k], roomSize + lane + k*W);
+            load(d1[k], damp1 + lane + k*W);
+            load(d2[k], damp2 + lane + k*W);
+        }
+
+        for (size_t t = 0, i = lane; t < frames; t++, i += lanes) {
+            for (int k = 0; k < K; k++) {
+                V xn, in, acc;
+                load(xn, x + i + k*W);
+                load(in, input + i + k*W);
+                load(acc, sum + i + k*W);
+                undenormalize(xn, tiny);
+                s[k] = d2[k] * xn + d1[k] * s[k];
+
+                V yn = s[k];
+                undenormalize(yn, tiny);
+                yn = in + room[k] * yn;
+                store(x + i + k*W, yn);
+                store(sum + i + k*W, V(acc + yn));
+            }
+        }
+
+        for (int k = 0; k < K; k++) {
+            store(state + lane + k*W, s[k]);
+        }
+    }
+
+    return lane;
+}
+
+template <typename T, typename V>
+static FREEVERB_INLINE void combLanesVector(T* x, const T* input, T* sum, T* state,
+                                            size_t lanes, size_t frames, const T* roomSize,
+                                            const T* damp1, const T* damp2) {
+    V tiny;
+    broadcast(tiny, (T) undenormal);
+
+    size_t lane = combLaneTiles<T, V, 2>(0, x, input, sum, state, lanes, frames, roomSize, damp1, damp2, tiny);
+    lane = combLaneTiles<T, V, 1>(lane, x, input, sum, state, lanes, frames, roomSize, damp1, damp2, tiny);
+    combLanesColumns(lane, x, input, sum, state, lanes, frames, roomSize, damp1, damp2);
+}
+
+template <bool U, typename T, typename V>
+static FREEVERB_INLINE void allPassVector(T* x, T* delay, size_t frames, T g) {
+    const size_t W = sizeof(V) / sizeof(T);
+    V gv, gOut, tiny;
+    broadcast(gv, g);
+    broadcast(gOut, T(1 + g));
+    broadcast(tiny, (T) undenormal);
+
+    size_t t = 0;
+    for (; t + W <= frames; t += W) {
+        V vn_m, xn;
+        load(vn_m, delay + t);
+        load(xn, x + t);
+        if (U) {
+            undenormalize(vn_m, tiny);
+        }
+        V vn = xn + (gv * vn_m);
+        store(delay + t, vn);
+        store(x + t, V(-vn + gOut*vn_m));
+    }
+    allPassFrames<U>(t, x, delay, frames, g);
+}
+
+// consecutive outputs share a vector and each tap is one multiply-add
+// across them; outputs further apart than that take a vector dot product
+template <typename T, typename V>
+static FREEVERB_INLINE void firVector(T* output, const T* input, size_t step, size_t count,
+                                      const T* taps, size_t numTaps) {
+    const size_t W = sizeof(V) / sizeof(T);
+    size_t j = 0;
+    if (step == 1) {
+        for (; j + W <= count; j += W) {
+            V y = V();
+            for (size_t k = 0; k < numTaps; k++) {
+                V xn, tap;
+                load(xn, input + j + k);
+                broadcast(tap, taps[k]);
+                y += tap * xn;
+            }
+            store(output + j, y);
+        }
+    }
+    else if (numTaps % W == 0) {
+        for (; j < count; j++) {
+            const T *in = input + j * step;
+            V y = V();
+            for (size_t k = 0; k < numTaps; k += W) {
+                V xn, tap;
+                load(xn, in + k);
+                load(tap, taps + k);
+                y += tap * xn;
+            }
+            T sum = 0;
+            for (size_t i = 0; i < W; i++) {
+                sum += y[i];
+            }
+            output[j] = sum;
+        }
+    }
+    firOutputs(j, output, input, step, count, taps, numTaps);
+}
+
+template <bool U, typename T>
+static void combBank128(T* x, const T* input, T* state, size_t lanes,
+                        size_t frames, T roomSize, T damp1, T damp2) {
+    combBankVector<U, T, typename Vectors<T>::v128>(x, input, state, lanes, frames, roomSize, damp1, damp2);
+}
+
+template <typename T>
+static void combLanes128(T* x, const T* input, T* sum, T* state,
+                         size_t lanes, size_t frames, const T* roomSize,
+                         const T* damp1, const T* damp2) {
+    combLanesVector<T, typename Vectors<T>::v128>(x, input, sum, state, lanes, frames, roomSize, damp1, damp2);
+}
+
+template <bool U, typename T>
+static void allPass128(T* x, T* delay, size_t frames, T g) {
+    allPassVector<U, T, typename Vectors<T>::v128>(x, delay, frames, g);
+}
+
+template <typename T>
+static void fir128(T* output, const T* input, size_t step, size_t count,
+                   const T* taps, size_t numTaps) {
+    firVector<T, typename Vectors<T>::v128>(output, input, step, count, taps, numTaps);
+}
+
+#if defined(FREEVERB_SIMD_X86)
+
+template <bool U, typename T>
+__attribute__((target("avx2")))
+static void combBank256(T* x, const T* input, T* state, size_t lanes,
+                        size_t frames, T roomSize, T damp1, T damp2) {
+    combBankVector<U, T, typename Vectors<T>::v256>(x, input, state, lanes, frames, roomSize, damp1, damp2);
+}
+
+template <typename T>
+__attribute__((target("avx2")))
+static void combLanes256(T* x, const T* input, T* sum, T* state,
+                         size_t lanes, size_t frames, const T* roomSize,
+                         const T* damp1, const T* damp2) {
+    combLanesVector<T, typename Vectors<T>::v256>(x, input, sum, state, lanes, frames, roomSize, damp1, damp2);
+}
+
+template <bool U, typename T>
+__attribute__((target("avx2")))
+static void allPass256(T* x, T* delay, size_t frames, T g) {
+    allPassVector<U, T, typename Vectors<T>::v256>(x, delay, frames, g);
+}
+
+template <typename T>
+__attribute__((target("avx2")))
+static void fir256(T* output, const T* input, size_t step, size_t count,
+                   const T* taps, size_t numTaps) {
+    firVector<T, typename Vectors<T>::v256>(output, input, step, count, taps, numTaps);
+}
+
+// AVX-512 brings FMA, which the compiler would otherwise contract the
+// multiply-adds into, rounding them differently from the other levels
+template <bool U, typename T>
+__attribute__((target("avx512f"), optimize("fp-contract=off")))
+static void combBank512(T* x, const T* input, T* state, size_t lanes,
+                        size_t frames, T roomSize, T damp1, T damp2) {
+    combBankVector<U, T, typename Vectors<T>::v512>(x, input, state, lanes, frames, roomSize, damp1, damp2);
+}
+
+template <typename T>
+__attribute__((target("avx512f"), optimize("fp-contract=off")))
+static void combLanes512(T* x, const T* input, T* sum, T* state,
+                         size_t lanes, size_t frames, const T* roomSize,
+                         const T* damp1, const T* damp2) {
+    combLanesVector<T, typename Vectors<T>::v512>(x, input, sum, state, lanes, frames, roomSize, damp1, damp2);
+}
+
+template <bool U, typename T>
+__attribute__((target("avx512f"), optimize("fp-contract=off")))
+static void allPass512(T* x, T* delay, size_t frames, T g) {
+    allPassVector<U, T, typename Vectors<T>::v512>(x, delay, frames, g);
+}
+
+template <typename T>
+__attribute__((target("avx512f"), optimize("fp-contract=off")))
+static void fir512(T* output, const T* input, size_t step, size_t count,
+                   const T* taps, size_t numTaps) {
+    firVector<T, typename Vectors<T>::v512>(output, input, step, count, taps, numTaps);
+}
+
+#endif // FREEVERB_SIMD_X86
+
+#endif // FREEVERB_SIMD_VECTOR
+
+// point the kernels of one sample type at the given level
+template <typename T>
+static void selectKernels(FreeVerbSimd::Level level) {
+    Kernels<T>::combBank[0] = combBankScalar<false, T>;
+    Kernels<T>::combBank[1] = combBankScalar<true, T>;
+    Kernels<T>::combLanes = combLanesScalar<T>;
+    Kernels<T>::allPass[0] = allPassScalar<false, T>;
+    Kernels<T>::allPass[1] = allPassScalar<true, T>;
+    Kernels<T>::fir = firScalar<T>;
+#if defined(FREEVERB_SIMD_VECTOR)
+    switch (level) {
+#if defined(FREEVERB_SIMD_X86)
+        case FreeVerbSimd::VECTOR512:
+            Kernels<T>::combBank[0] = combBank512<false, T>;
+            Kernels<T>::combBank[1] = combBank512<true, T>;
+            Kernels<T>::combLanes = combLanes512<T>;
+            Kernels<T>::allPass[0] = allPass512<false, T>;
+            Kernels<T>::allPass[1] = allPass512<true, T>;
+            Kernels<T>::fir = fir512<T>;
+            break;
+        case FreeVerbSimd::VECTOR256:
+            Kernels<T>::combBank[0] = combBank256<false, T>;
+            Kernels<T>::combBank[1] = combBank256<true, T>;
+            Kernels<T>::combLanes = combLanes256<T>;
+            Kernels<T>::allPass[0] = allPass256<false, T>;
+            Kernels<T>::allPass[1] = allPass256<true, T>;
+            Kernels<T>::fir = fir256<T>;
+            break;
+#endif
+        case FreeVerbSimd::VECTOR128:
+            Kernels<T>::combBank[0] = combBank128<false, T>;
+            Kernels<T>::combBank[1] = combBank128<true, T>;
+            Kernels<T>::combLanes = combLanes128<T>;
+            Kernels<T>::allPass[0] = allPass128<false, T>;
+            Kernels<T>::allPass[1] = allPass128<true, T>;
+            Kernels<T>::fir = fir128<T>;
+            break;
+        default:
+            break;
+    }
+#endif
+}
+
+static FreeVerbSimd::Level currentLevel = FreeVerbSimd::setLevel(FreeVerbSimd::detect());
+
+FreeVerbSimd::Level FreeVerbSimd::detect() {
+#if defined(FREEVERB_SIMD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return VECTOR512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return VECTOR256;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return VECTOR128;
+    }
+    return SCALAR;
+#elif defined(FREEVERB_SIMD_VECTOR)
+    return VECTOR128;
+#else
+    return SCALAR;
+#endif
+}
+
+FreeVerbSimd::Level FreeVerbSimd::level() {
+    return currentLevel;
+}
+
+FreeVerbSimd::Level FreeVerbSimd::setLevel(Level level) {
+    Level supported = detect();
+    if (level > supported) {
+        level = supported;
+    }
+
+    selectKernels<StkFloat>(level);
+    selectKernels<float>(level);
+
+    currentLevel = level;
+    return level;
+}
+
+const char* FreeVerbSimd::name(Level level) {
+    switch (level) {
+        case VECTOR128:
+            return "vector128";
+        case VECTOR256:
+            return "vector256";
+        case VECTOR512:
+            return "vector512";
+        default:
+            return "scalar";
+    }
+}
+
+void FreeVerbSimd::combBank(StkFloat* x, const StkFloat* input, StkFloat* state, size_t lanes,
+                            size_t frames, StkFloat roomSize, StkFloat damp1, StkFloat damp2,
+                            bool undenormalize) {
+    Kernels<StkFloat>::combBank[undenormalize](x, input, state, lanes, frames, roomSize, damp1, damp2);
+}
+
+void FreeVerbSimd::combBank(float* x, const float* input, float* state, size_t lanes,
+                            size_t frames, float roomSize, float damp1, float damp2,
+                            bool undenormalize) {
+    Kernels<float>::combBank[undenormalize](x, input, state, lanes, frames, roomSize, damp1, damp2);
+}
+
+void FreeVerbSimd::combLanes(StkFloat* x, const StkFloat* input, StkFloat* sum, StkFloat* state,
+                             size_t lanes, size_t frames, const StkFloat* roomSize,
+                             const StkFloat* damp1, const StkFloat* damp2) {
+    Kernels<StkFloat>::combLanes(x, input, sum, state, lanes, frames, roomSize, damp1, damp2);
+}
+
+void FreeVerbSimd::combLanes(float* x, const float* input, float* sum, float* state,
+                             size_t lanes, size_t frames, const float* roomSize,
+                             const float* damp1, const float* damp2) {
+    Kernels<float>::combLanes(x, input, sum, state, lanes, frames, roomSize, damp1, damp2);
+}
+
+void FreeVerbSimd::allPass(StkFloat* x, StkFloat* delay, size_t frames, StkFloat g, bool undenormalize) {
+    Kernels<StkFloat>::allPass[undenormalize](x, delay, frames, g);
+}
+
+void FreeVerbSimd::allPass(float* x, float* delay, size_t frames, float g, bool undenormalize) {
+    Kernels<float>::allPass[undenormalize](x, delay, frames, g);
+}
+
+void FreeVerbSimd::fir(StkFloat* output, const StkFloat* input, size_t step, size_t count,
+                       const StkFloat* taps, size_t numTaps) {
+    Kernels<StkFloat>::fir(output, input, step, count, taps, numTaps);
+}
+
+void FreeVerbSimd::fir(float* output, const float* input, size_t step, size_t count,
+                       const float* taps, size_t numTaps) {
+    Kernels<float>::fir(output, input, step, count, taps, numTaps);
+}
+
+#if defined(FREEVERB_SIMD_X86)
+// MXCSR flush-to-zero and denormals-are-zero bits
+static const unsigned int mxcsrFlush = 0x8040;
+#elif defined(__GNUC__) && defined(__aarch64__)
+#define FREEVERB_SIMD_FPCR
+// FPCR flush-to-zero bit, which on AArch64 covers inputs too
+static const unsigned long fpcrFlush = 1UL << 24;
+#endif
+
+bool FreeVerbSimd::canFlushDenormals() {
+#if defined(FREEVERB_SIMD_X86)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+#elif defined(FREEVERB_SIMD_FPCR)
+    return true;
+#else
+    return false;
+#endif
+}
+
+FreeVerbSimd::DenormalGuard::DenormalGuard(bool enable) : active_(false), saved_(0) {
+    if (!enable) {
+        return;
+    }
+#if defined(FREEVERB_SIMD_X86)
+    unsigned int csr;
+    __asm__ __volatile__("stmxcsr %0" : "=m"(csr));
+    saved_ = csr;
+    if ((csr & mxcsrFlush) != mxcsrFlush) {
+        csr |= mxcsrFlush;
+        __asm__ __volatile__("ldmxcsr %0" : : "m"(csr));
+        active_ = true;
+    }
+#elif defined(FREEVERB_SIMD_FPCR)
+    unsigned long fpcr;
+    __asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+    saved_ = fpcr;
+    if (!(fpcr & fpcrFlush)) {
+        fpcr |= fpcrFlush;
+        __asm__ __volatile__("msr fpcr, %0" : : "r"(fpcr));
+        active_ = true;
+    }
+#endif
+}
+
+FreeVerbSimd::DenormalGuard::~DenormalGuard() {
+    if (!active_) {
+        return;
+    }
+#if defined(FREEVERB_SIMD_X86)
+    unsigned int csr = (unsigned int) saved_;
+    __asm__ __volatile__("ldmxcsr %0" : : "m"(csr));
+#elif defined(FREEVERB_SIMD_FPCR)
+    unsigned long fpcr = saved_;
+    __asm__ __volatile__("msr fpcr, %0" : : "r"(fpcr));
+#endif
+}
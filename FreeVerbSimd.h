@@ -0,0 +1,150 @@
+#ifndef STK_FREEVERBSIMD_H
+#define STK_FREEVERBSIMD_H
+
+#include "Stk.h"
+#include <cstddef>
+
+namespace stk {
+
+/**************************************************************************/
+/*! \class FreeVerbSimd
+    \brief Runtime-dispatched vector kernels for FreeVerb
+
+    The comb bank kernel runs every lowpass feedback comb filter as
+    one lane of a vector register. It works on a transposed block of
+    delay line outputs laid out [frame][lane], so the lanes of a
+    frame are contiguous no matter how long each delay line is.
+
+    The lanes variant takes a separate input and parameters for every
+    lane and accumulates its outputs, for FreeVerbBank, whose delay
+    lines already hold one lane per voice.
+
+    The allpass kernel runs over a contiguous span of one allpass
+    delay line. Every allpass delay is longer than the blocks FreeVerb
+    hands it, so the frames of a span are independent and are
+    vectorized in time.
+
+    The FIR kernel does FreeVerb's resampling in economy mode, vectorized
+    across outputs when they are consecutive and across taps otherwise.
+
+    Every kernel comes in StkFloat and float versions; a float vector
+    holds twice as many lanes as a StkFloat one of the same width.
+
+    The instruction set is picked once, from what the CPU supports:
+    AVX-512, AVX2 or SSE2 on x86, 128-bit vectors (NEON) on other
+    GCC-compatible targets, and plain scalar code otherwise.
+*/
+/***************************************************************************/
+
+class FreeVerbSimd
+{
+    public:
+        //! instruction set levels, from slowest to fastest
+        enum Level {
+            SCALAR,      /*!< plain C++ */
+            VECTOR128,   /*!< SSE2 or NEON */
+            VECTOR256,   /*!< AVX2 */
+            VECTOR512    /*!< AVX-512, without FMA so it rounds as the others do */
+        };
+
+        //! returns the highest level supported by this CPU
+        static Level detect();
+
+        //! returns the level currently in use
+        static Level level();
+
+        //! select the level to use, clamped to what the CPU supports
+        /*!
+          Returns the level actually selected. This affects every FreeVerb
+          instance and must not be called while audio is being processed.
+        */
+        static Level setLevel(Level level);
+
+        //! returns a printable name for the given level
+        static const char* name(Level level);
+
+        //! run a block of frames through a bank of lowpass feedback comb filters
+        /*!
+          x holds the delay line outputs, frames x lanes, and is overwritten
+          with the comb outputs. input holds one comb input per frame and
+          state holds the lowpass state of each lane. undenormalize selects
+          the legacy FreeVerb::undenormalize() treatment of the feedback path;
+          leave it off when denormals are taken care of some other way.
+        */
+        static void combBank(StkFloat* x, const StkFloat* input, StkFloat* state, size_t lanes,
+                             size_t frames, StkFloat roomSize, StkFloat damp1, StkFloat damp2,
+                             bool undenormalize = true);
+
+        //! float version of combBank()
+        static void combBank(float* x, const float* input, float* state, size_t lanes,
+                             size_t frames, float roomSize, float damp1, float damp2,
+                             bool undenormalize = true);
+
+        //! run a block of frames through a bank of combs with their own inputs and parameters
+        /*!
+          x, input and sum are all frames x lanes. x holds the delay line
+          outputs and is overwritten with the comb outputs, which are also
+          added to sum. roomSize, damp1, damp2 and state hold one value per lane.
+        */
+        static void combLanes(StkFloat* x, const StkFloat* input, StkFloat* sum, StkFloat* state,
+                              size_t lanes, size_t frames, const StkFloat* roomSize,
+                              const StkFloat* damp1, const StkFloat* damp2);
+
+        //! float version of combLanes()
+        static void combLanes(float* x, const float* input, float* sum, float* state,
+                              size_t lanes, size_t frames, const float* roomSize,
+                              const float* damp1, const float* damp2);
+
+        //! run a span of frames through one Schroeder allpass filter in place
+        /*!
+          delay points at the span of the delay line to read and then overwrite,
+          it must not overlap itself within the span. undenormalize is as
+          for combBank().
+        */
+        static void allPass(StkFloat* x, StkFloat* delay, size_t frames, StkFloat g,
+                            bool undenormalize = true);
+
+        //! float version of allPass()
+        static void allPass(float* x, float* delay, size_t frames, float g,
+                            bool undenormalize = true);
+
+        //! run a FIR filter for count outputs, step input samples apart
+        /*!
+          output[j] is the sum over k of taps[k] * input[j*step + k], so
+          taps run oldest sample first. A step above one decimates.
+        */
+        static void fir(StkFloat* output, const StkFloat* input, size_t step, size_t count,
+                        const StkFloat* taps, size_t numTaps);
+
+        //! float version of fir()
+        static void fir(float* output, const float* input, size_t step, size_t count,
+                        const float* taps, size_t numTaps);
+
+        //! returns true if the CPU can be told to flush denormals to zero
+        static bool canFlushDenormals();
+
+        //! Flushes denormals to zero on the calling thread while in scope
+        /*!
+          Sets the flush-to-zero and denormals-are-zero modes of the
+          floating point unit (MXCSR on x86, FPCR.FZ on AArch64) when
+          constructed with enable set, and puts back the previous mode
+          when destroyed. Does nothing where canFlushDenormals() is false.
+        */
+        class DenormalGuard
+        {
+            public:
+                DenormalGuard(bool enable = true);
+                ~DenormalGuard();
+
+            private:
+                DenormalGuard(const DenormalGuard&);
+                DenormalGuard& operator=(const DenormalGuard&);
+
+                bool active_;
+                unsigned long saved_;
+        };
+};
+
+}
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef STK_MAILBOX_H
+#define STK_MAILBOX_H
+
+#include <atomic>
+
+namespace stk {
+
+/**************************************************************************/
+/*! \class Mailbox
+    \brief A wait-free single value mailbox between two threads
+
+    Passes whole snapshots of a value from one writing thread to one
+    reading thread, such as a control thread setting the parameters an
+    audio callback picks up once per block. It is triple buffered: the
+    writer fills its own slot and swaps it with the middle slot, the
+    reader swaps the middle slot with its own when a new value is
+    there. Neither side ever waits or allocates, the reader always
+    sees a complete value, and writes the reader has not yet taken are
+    replaced by newer ones.
+
+    Only one thread may write, and only one may read, at a time. T must
+    be copyable without allocating for read() to be realtime safe.
+*/
+/***************************************************************************/
+
+template <typename T>
+class Mailbox
+{
+    public:
+        Mailbox() : writeSlot_(0), middle_(1), readSlot_(2) {}
+
+        //! post a new value, replacing any the reader has not taken
+        void write(const T& value) {
+            slots_[writeSlot_].value = value;
+            writeSlot_ = middle_.exchange(writeSlot_ | fresh, std::memory_order_acq_rel) & slotMask;
+        }
+
+        //! take the latest value into value, returns false if there is nothing new
+        bool read(T& value) {
+            if (!(middle_.load(std::memory_order_acquire) & fresh)) {
+                return false;
+            }
+            readSlot_ = middle_.exchange(readSlot_, std::memory_order_acq_rel) & slotMask;
+            value = slots_[readSlot_].value;
+            return true;
+        }
+
+    private:
+        Mailbox(const Mailbox&);
+        Mailbox& operator=(const Mailbox&);
+
+        // the middle slot index carries a flag for a value not yet read
+        static const unsigned int fresh = 4;
+        static const unsigned int slotMask = 3;
+
+        // each slot on its own cache line so the threads never share one
+        struct Slot {
+            alignas(64) T value;
+        };
+
+        Slot slots_[3];
+        alignas(64) unsigned int writeSlot_;
+        alignas(64) std::atomic<unsigned int> middle_;
+        alignas(64) unsigned int readSlot_;
+};
+
+}
+
+#endif
@@ -0,0 +1,853 @@
+/*
+ * MUMT 618 Final project
+ * Gregory Burlet, 2012
+ *
+ * Benchmark for the Stk implementation of FreeVerb.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <stdint.h>
+
+#include "../FreeVerb.h"
+#include "../FreeVerbMulti.h"
+#include "../FreeVerbBank.h"
+#include "../FreeVerbFixed.h"
+#include "../FreeVerbPool.h"
+#include "../FreeVerbSimd.h"
+
+using namespace stk;
+
+typedef std::chrono::steady_clock Clock;
+
+static void usage(const char *program) {
+    std::cout << "usage: " << program << " [-seconds seconds] [-quick]" << std::endl;
+    std::cout << "  times every processing path over channels, sampling rates, block sizes, freeze mode" << std::endl;
+    std::cout << "  and input, writing one CSV line per case; each case runs 'seconds' of audio (default 1)" << std::endl;
+    std::cout << "  -quick keeps to 44.1kHz and blocks of 64 and 1024 frames" << std::endl;
+    std::cout << "   or: " << program << " -denormals [-block frames] [-tail seconds] [-window seconds]" << std::endl;
+    std::cout << "  runs a one second noise burst and then silence through every denormal strategy," << std::endl;
+    std::cout << "  reporting ns per frame for the burst and for each window of the decaying tail" << std::endl;
+    std::cout << "   or: " << program << " -multichannel [-block frames]" << std::endl;
+    std::cout << "  compares FreeVerbMulti for 2 to 8 channels with as many stereo FreeVerbs" << std::endl;
+    std::cout << "   or: " << program << " -bank voices [-block frames]" << std::endl;
+    std::cout << "  compares a FreeVerbBank of that many voices with as many FreeVerbs, in voices per core" << std::endl;
+    std::cout << "   or: " << program << " -check" << std::endl;
+    std::cout << "  checks the reverbs' behaviour rather than timing it, failing if any check does" << std::endl;
+    exit(0);
+}
+
+// the ways of driving a reverb that are timed
+enum Path {
+    TICK,           // tick(inputL, inputR, channel), one frame at a time
+    FRAMES_INPLACE, // tick(StkFrames&)
+    FRAMES_INOUT,   // tick(StkFrames&, StkFrames&)
+    PROCESS         // process() on planar float buffers
+};
+
+static const char* pathName(Path path) {
+    switch (path) {
+        case TICK:
+            return "tick";
+        case FRAMES_INPLACE:
+            return "frames_inplace";
+        case FRAMES_INOUT:
+            return "frames_inout";
+        default:
+            return "process";
+    }
+}
+
+// one benchmark case
+struct Case {
+    Path path;
+    unsigned int channels;  // input channels, the output is always stereo
+    StkFloat rate;
+    unsigned int block;     // frames per call, 1 for TICK
+    bool frozen;
+    bool tail;              // silent input after a noise burst, rather than noise
+};
+
+// best of this many runs of each case
+static const int repeats = 3;
+
+// seconds of silence after the noise burst before a tail is timed
+static const int tailSeconds = 20;
+
+static StkFloat noise() {
+    return std::rand() / (RAND_MAX + 1.0) - 0.5;
+}
+
+// ns per frame to run the case's input through fv, the best of several runs
+template <typename Reverb>
+static double timeCase(Reverb &fv, const Case &c, StkFrames &input) {
+    const unsigned int frames = input.frames();
+    const unsigned int block = c.block;
+    StkFrames iFrames(block, c.channels), oFrames(block, 2);
+
+    // planar copies for process()
+    std::vector<float> left(frames), right(frames), outL(block), outR(block);
+    for (unsigned int t = 0; t < frames; t++) {
+        left[t] = (float) input(t, 0);
+        right[t] = (float) input(t, c.channels - 1);
+    }
+
+    // keeps the compiler from dropping the scalar path's results
+    volatile StkFloat sink = 0.0;
+
+    double best = 0.0;
+    for (int r = 0; r < repeats; r++) {
+        Clock::time_point start = Clock::now();
+        if (c.path == TICK) {
+            StkFloat sum = 0.0;
+            for (unsigned int t = 0; t < frames; t++) {
+                if (c.channels == 2) {
+                    sum += fv.tick(input(t, 0), input(t, 1), 0);
+                }
+                else {
+                    sum += fv.tick(input(t, 0));
+                }
+                sum += fv.lastOut(1);
+            }
+            sink = sum;
+        }
+        else {
+            for (unsigned int done = 0; done + block <= frames; done += block) {
+                if (c.path == PROCESS) {
+                    fv.process(&left[done], (c.channels == 2) ? &right[done] : NULL, &outL[0], &outR[0], block);
+                    continue;
+                }
+
+                // in place processing overwrites its input, so it is copied in every time
+                std::memcpy(&iFrames[0], &input(done, 0), sizeof(StkFloat) * block * c.channels);
+                if (c.path == FRAMES_INPLACE) {
+                    fv.tick(iFrames);
+                }
+                else {
+                    fv.tick(iFrames, oFrames);
+                }
+            }
+        }
+        std::chrono::duration<double> elapsed = Clock::now() - start;
+        double ns = elapsed.count() * 1e9 / (frames / block * block);
+        if (r == 0 || ns < best) {
+            best = ns;
+        }
+    }
+    (void) sink;
+
+    return best;
+}
+
+// runs one case on a new reverb and writes its CSV line
+template <typename Reverb>
+static void runCase(const char *type, const Case &c, StkFloat seconds) {
+    // the delay lengths follow the sampling rate at construction
+    Stk::setSampleRate(c.rate);
+    Reverb fv;
+
+    // a tail is timed once a short, heavily damped room has decayed
+    // for a while, well into the range where denormals appear
+    if (c.tail) {
+        fv.setRoomSize(0.0);
+        fv.setDamp(1.0);
+    }
+
+    // a second of noise fills the reverb before anything is timed
+    const unsigned int rate = (unsigned int) c.rate;
+    StkFrames burst(rate, c.channels);
+    for (unsigned int i = 0; i < burst.size(); i++) {
+        burst[i] = noise();
+    }
+    fv.tick(burst);
+    if (c.tail) {
+        burst.resize(rate, c.channels, 0.0);
+        for (int s = 0; s < tailSeconds; s++) {
+            fv.tick(burst);
+        }
+    }
+    fv.setMode(c.frozen);
+
+    StkFrames input((unsigned int) (seconds * c.rate), c.channels);
+    for (unsigned int i = 0; i < input.size(); i++) {
+        input[i] = c.tail ? 0.0 : noise();
+    }
+
+    double ns = timeCase(fv, c, input);
+    std::cout << type << "," << pathName(c.path) << "," << c.channels << "," << rate << "," << c.block << ","
+              << (c.frozen ? "on" : "off") << "," << (c.tail ? "tail" : "noise") << ","
+              << FreeVerbSimd::name(FreeVerbSimd::level()) << "," << ns << "," << 1e9 / (ns * c.rate) << std::endl;
+}
+
+// every case, as CSV on standard output
+static int runSuite(StkFloat seconds, bool quick) {
+    const Path paths[] = { TICK, FRAMES_INPLACE, FRAMES_INOUT, PROCESS };
+    const StkFloat allRates[] = { 44100.0, 48000.0, 96000.0 };
+    const unsigned int allBlocks[] = { 32, 64, 128, 256, 512, 1024, 2048, 4096 };
+    const unsigned int quickBlocks[] = { 64, 1024 };
+    const unsigned int numRates = quick ? 1 : 3;
+    const unsigned int *blocks = quick ? quickBlocks : allBlocks;
+    const unsigned int numBlocks = quick ? 2 : 8;
+
+    std::cout << std::setprecision(6);
+    std::cout << "type,path,channels,rate,block,freeze,input,kernels,ns_per_frame,instances_per_core" << std::endl;
+    for (int p = 0; p < 4; p++) {
+        for (unsigned int channels = 1; channels <= 2; channels++) {
+            for (unsigned int r = 0; r < numRates; r++) {
+                // the scalar path has no block size
+                for (unsigned int b = 0; b < (paths[p] == TICK ? 1 : numBlocks); b++) {
+                    for (int frozen = 0; frozen < 2; frozen++) {
+                        for (int tail = 0; tail < 2; tail++) {
+                            Case c;
+                            c.path = paths[p];
+                            c.channels = channels;
+                            c.rate = allRates[r];
+                            c.block = (paths[p] == TICK) ? 1 : blocks[b];
+                            c.frozen = frozen;
+                            c.tail = tail;
+                            runCase<FreeVerb>("double", c, seconds);
+                            runCase<FreeVerbFloat>("float", c, seconds);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+static const char* strategyName(FreeVerb::Denormals denormals) {
+    switch (denormals) {
+        case FreeVerb::FLUSH_TO_ZERO:
+            return "flush";
+        case FreeVerb::DC_OFFSET:
+            return "offset";
+        default:
+            return "undenormalize";
+    }
+}
+
+// ns per frame to run frames of input through fv a block at a time
+template <typename Reverb>
+static double timeFrames(Reverb &fv, const std::vector<float> &input, std::vector<float> &left,
+                         std::vector<float> &right, size_t offset, size_t frames) {
+    const size_t block = left.size();
+    Clock::time_point start = Clock::now();
+    for (size_t done = 0; done < frames; done += block) {
+        size_t n = std::min(block, frames - done);
+        fv.process(&input[offset + done], NULL, &left[0], &right[0], n);
+    }
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    return elapsed.count() * 1e9 / frames;
+}
+
+// one row of the report: the burst and then every tail window
+template <typename Reverb>
+static void run(const char *type, typename Reverb::Denormals denormals, const std::vector<float> &input,
+                size_t block, size_t burst, size_t window) {
+    Reverb fv;
+
+    // a short, heavily damped room decays into the denormal range soonest
+    fv.setRoomSize(0.0);
+    fv.setDamp(1.0);
+    fv.setMix(1.0);
+    fv.setDenormals(denormals);
+
+    std::vector<float> left(block), right(block);
+    std::cout << std::setw(8) << type << std::setw(15) << strategyName((FreeVerb::Denormals) fv.getDenormals());
+    std::cout << std::setw(9) << timeFrames(fv, input, left, right, 0, burst);
+    for (size_t offset = burst; offset < input.size(); offset += window) {
+        std::cout << std::setw(9) << timeFrames(fv, input, left, right, offset, window);
+    }
+    std::cout << std::endl;
+}
+
+// the denormal strategy report
+static int runDenormals(size_t block, StkFloat tail, StkFloat window) {
+    size_t burstFrames = (size_t) Stk::sampleRate();
+    size_t windowFrames = std::max((size_t) (window * Stk::sampleRate()), (size_t) 1);
+    size_t windows = std::max((size_t) (tail / window), (size_t) 1);
+
+    // noise, then silence for the tail
+    std::vector<float> input(burstFrames + windows * windowFrames, 0.0f);
+    for (size_t i = 0; i < burstFrames; i++) {
+        input[i] = (float) noise();
+    }
+
+    std::cout << FreeVerbSimd::name(FreeVerbSimd::level()) << " kernels, " << block
+              << " frame blocks, ns per frame" << std::endl;
+    std::cout << std::setw(8) << "type" << std::setw(15) << "denormals" << std::setw(9) << "burst";
+    for (size_t w = 0; w < windows; w++) {
+        std::ostringstream label;
+        label << "+" << (w + 1) * window << "s";
+        std::cout << std::setw(9) << label.str();
+    }
+    std::cout << std::endl;
+
+    const FreeVerb::Denormals strategies[] = { FreeVerb::UNDENORMALIZE, FreeVerb::FLUSH_TO_ZERO, FreeVerb::DC_OFFSET };
+    for (int s = 0; s < 3; s++) {
+        run<FreeVerb>("double", strategies[s], input, block, burstFrames, windowFrames);
+    }
+    for (int s = 0; s < 3; s++) {
+        run<FreeVerbFloat>("float", (FreeVerbFloat::Denormals) strategies[s], input, block, burstFrames, windowFrames);
+    }
+
+    return 0;
+}
+
+// ns per frame for fv to run a stereo source into all of its channels
+static double timeMulti(FreeVerbMulti &fv, const std::vector<float> &input, size_t block) {
+    const unsigned int channels = fv.channels();
+    std::vector<float> out(block * channels);
+    std::vector<const float*> in(channels, (const float*) NULL);
+    std::vector<float*> outs(channels);
+    for (unsigned int c = 0; c < channels; c++) {
+        outs[c] = &out[c * block];
+    }
+
+    double best = 0.0;
+    for (int r = 0; r < repeats; r++) {
+        Clock::time_point start = Clock::now();
+        for (size_t done = 0; done + block <= input.size(); done += block) {
+            in[0] = &input[done];
+            in[1 % channels] = &input[done];
+            fv.process(&in[0], &outs[0], block);
+        }
+        std::chrono::duration<double> elapsed = Clock::now() - start;
+        double ns = elapsed.count() * 1e9 / (input.size() / block * block);
+        if (r == 0 || ns < best) {
+            best = ns;
+        }
+    }
+    return best;
+}
+
+// ns per frame for stereo FreeVerbs side by side to do the same
+static double timeStereo(std::vector<FreeVerb> &fvs, const std::vector<float> &input, size_t block) {
+    std::vector<float> outL(block), outR(block);
+
+    double best = 0.0;
+    for (int r = 0; r < repeats; r++) {
+        Clock::time_point start = Clock::now();
+        for (size_t done = 0; done + block <= input.size(); done += block) {
+            for (size_t v = 0; v < fvs.size(); v++) {
+                fvs[v].process(&input[done], &input[done], &outL[0], &outR[0], block);
+            }
+        }
+        std::chrono::duration<double> elapsed = Clock::now() - start;
+        double ns = elapsed.count() * 1e9 / (input.size() / block * block);
+        if (r == 0 || ns < best) {
+            best = ns;
+        }
+    }
+    return best;
+}
+
+// the multichannel report
+static int runMultichannel(size_t block) {
+    std::vector<float> input((size_t) Stk::sampleRate());
+    for (size_t i = 0; i < input.size(); i++) {
+        input[i] = (float) noise();
+    }
+
+    std::cout << FreeVerbSimd::name(FreeVerbSimd::level()) << " kernels, " << block
+              << " frame blocks, ns per frame" << std::endl;
+    std::cout << std::setw(9) << "channels" << std::setw(9) << "multi" << std::setw(9) << "stereo"
+              << std::setw(9) << "ratio" << std::endl;
+    for (unsigned int channels = 2; channels <= 8; channels += 2) {
+        FreeVerbMulti multi(channels);
+        std::vector<FreeVerb> stereo(channels / 2);
+        double m = timeMulti(multi, input, block);
+        double s = timeStereo(stereo, input, block);
+        std::cout << std::setw(9) << channels << std::setw(9) << m << std::setw(9) << s
+                  << std::setw(9) << m / s << std::endl;
+    }
+
+    return 0;
+}
+
+// ns per frame for a bank to run a stereo source through every voice
+static double timeBank(FreeVerbBank &bank, const std::vector<float> &input, size_t block) {
+    const unsigned int voices = bank.voices();
+    std::vector<float> out(2 * block * voices);
+    std::vector<const float*> in(voices);
+    std::vector<float*> outL(voices), outR(voices);
+    for (unsigned int v = 0; v < voices; v++) {
+        outL[v] = &out[2 * v * block];
+        outR[v] = &out[(2 * v + 1) * block];
+    }
+
+    double best = 0.0;
+    for (int r = 0; r < repeats; r++) {
+        Clock::time_point start = Clock::now();
+        for (size_t done = 0; done + block <= input.size(); done += block) {
+            std::fill(in.begin(), in.end(), &input[done]);
+            bank.process(&in[0], &in[0], &outL[0], &outR[0], block);
+        }
+        std::chrono::duration<double> elapsed = Clock::now() - start;
+        double ns = elapsed.count() * 1e9 / (input.size() / block * block);
+        if (r == 0 || ns < best) {
+            best = ns;
+        }
+    }
+    return best;
+}
+
+// the bank report
+static int runBank(unsigned int voices, size_t block) {
+    std::vector<float> input((size_t) Stk::sampleRate());
+    for (size_t i = 0; i < input.size(); i++) {
+        input[i] = (float) noise();
+    }
+
+    FreeVerbBank bank(voices);
+    std::vector<FreeVerb> scalar(voices);
+    double b = timeBank(bank, input, block);
+    double s = timeStereo(scalar, input, block);
+
+    // voices one core could run in real time
+    const StkFloat rate = Stk::sampleRate();
+    std::cout << FreeVerbSimd::name(FreeVerbSimd::level()) << " kernels, " << block
+              << " frame blocks, " << voices << " voices" << std::endl;
+    std::cout << std::setw(9) << "" << std::setw(14) << "ns_per_frame" << std::setw(17) << "voices_per_core"
+              << std::endl;
+    std::cout << std::setw(9) << "bank" << std::setw(14) << b << std::setw(17) << voices * 1e9 / (b * rate)
+              << std::endl;
+    std::cout << std::setw(9) << "scalar" << std::setw(14) << s << std::setw(17) << voices * 1e9 / (s * rate)
+              << std::endl;
+
+    return 0;
+}
+
+// reports one check, returns whether it passed
+static bool report(const char *name, bool passed, const std::string &detail) {
+    std::cout << std::setw(24) << std::left << name << std::right << (passed ? "ok" : "FAILED");
+    if (!detail.empty()) {
+        std::cout << "  " << detail;
+    }
+    std::cout << std::endl;
+    return passed;
+}
+
+// a cleared reverb runs on parameters set just before clear(), with no glide
+static bool checkClear() {
+    std::vector<float> input((size_t) Stk::sampleRate());
+    for (size_t i = 0; i < input.size(); i++) {
+        input[i] = (float) noise();
+    }
+    std::vector<float> left(input.size()), right(input.size()), freshL(input.size()), freshR(input.size());
+
+    FreeVerbFloat used;
+    used.setSmoothing(0.5);
+    used.process(&input[0], NULL, &left[0], &right[0], input.size());
+    used.setMix(0.2);
+    used.setRoomSize(0.9);
+    used.clear();
+    used.process(&input[0], NULL, &left[0], &right[0], input.size());
+
+    FreeVerbFloat fresh;
+    fresh.setMix(0.2);
+    fresh.setRoomSize(0.9);
+    fresh.process(&input[0], NULL, &freshL[0], &freshR[0], input.size());
+
+    size_t first = input.size();
+    for (size_t t = 0; t < input.size() && first == input.size(); t++) {
+        if (left[t] != freshL[t] || right[t] != freshR[t]) {
+            first = t;
+        }
+    }
+    std::ostringstream detail;
+    if (first < input.size()) {
+        detail << "differs from a new reverb from frame " << first;
+    }
+    return report("clear", first == input.size(), detail.str());
+}
+
+// every voice of a bank sounds exactly like a FreeVerb with its settings
+static bool checkBank() {
+    const unsigned int voices = 7;
+    const size_t frames = (size_t) Stk::sampleRate();
+    FreeVerbBank bank(voices);
+    std::vector<FreeVerb> scalar(voices);
+
+    std::vector<std::vector<StkFloat> > inL(voices), inR(voices), outL(voices), outR(voices);
+    std::vector<const StkFloat*> pInL(voices), pInR(voices);
+    std::vector<StkFloat*> pOutL(voices), pOutR(voices);
+    for (unsigned int v = 0; v < voices; v++) {
+        FreeVerb::Parameters parameters;
+        parameters.mix = (v + 1) / (StkFloat) voices;
+        parameters.roomSize = (StkFloat) v / (voices - 1);
+        parameters.damp = 1.0 - parameters.roomSize;
+        parameters.width = (v % 3) / 2.0;
+        parameters.frozen = (v == 2);
+        bank.setParameters(v, parameters);
+        scalar[v].setParameters(parameters);
+
+        inL[v].resize(frames);
+        inR[v].resize(frames);
+        for (size_t t = 0; t < frames; t++) {
+            inL[v][t] = noise();
+            inR[v][t] = noise();
+        }
+        outL[v].resize(frames);
+        outR[v].resize(frames);
+    }
+
+    // uneven blocks, with one voice's right input missing
+    const size_t blocks[] = { 1, 17, 256, 1000, 4096 };
+    for (size_t done = 0, b = 0; done < frames; b++) {
+        size_t n = std::min(blocks[b % 5], frames - done);
+        for (unsigned int v = 0; v < voices; v++) {
+            pInL[v] = &inL[v][done];
+            pInR[v] = (v == 4) ? NULL : &inR[v][done];
+            pOutL[v] = &outL[v][done];
+            pOutR[v] = &outR[v][done];
+        }
+        bank.process(&pInL[0], &pInR[0], &pOutL[0], &pOutR[0], n);
+        done += n;
+    }
+
+    std::vector<StkFloat> left(frames), right(frames);
+    std::ostringstream detail;
+    bool passed = true;
+    for (unsigned int v = 0; v < voices && passed; v++) {
+        scalar[v].process(&inL[v][0], (v == 4) ? NULL : &inR[v][0], &left[0], &right[0], frames);
+        for (size_t t = 0; t < frames && passed; t++) {
+            if (left[t] != outL[v][t] || right[t] != outR[v][t]) {
+                detail << "voice " << v << " differs from FreeVerb from frame " << t;
+                passed = false;
+            }
+        }
+    }
+    return report("bank", passed, detail.str());
+}
+
+// how far a fixed point reverb's output strays from FreeVerb's, in dBFS
+struct FixedError {
+    StkFloat rms;
+    StkFloat peak;
+};
+
+static FixedError fixedError(const std::vector<StkFloat> &refL, const std::vector<StkFloat> &refR,
+                             const std::vector<StkFloat> &left, const std::vector<StkFloat> &right) {
+    StkFloat energy = 0.0, peak = 0.0;
+    for (size_t t = 0; t < refL.size(); t++) {
+        StkFloat dL = left[t] - refL[t], dR = right[t] - refR[t];
+        energy += dL * dL + dR * dR;
+        peak = std::max(peak, std::max(std::fabs(dL), std::fabs(dR)));
+    }
+    FixedError error;
+    error.rms = 10.0 * std::log10(energy / (2 * refL.size()) + 1e-30);
+    error.peak = 20.0 * std::log10(peak + 1e-15);
+    return error;
+}
+
+// FreeVerbFixed keeps within the error bound FreeVerbFixed.h documents,
+// in Q15 and in Q31, for noise and tone bursts peaking at -6 dBFS and below
+static bool checkFixed() {
+    const size_t frames = 2 * (size_t) Stk::sampleRate();
+    const StkFloat levels[] = { 0.5, 0.05 };
+    const StkFloat rooms[] = { 0.0, 0.5, 1.0 };
+    const StkFloat damps[] = { 0.0, 1.0 };
+    const StkFloat mixes[] = { 1.0, 0.3 };
+
+    // the documented bound
+    const StkFloat maxRms = -60.0, maxSmallRoomRms = -67.0, maxPeak = -45.0;
+
+    std::vector<int16_t> in16L(frames), in16R(frames), out16L(frames), out16R(frames);
+    std::vector<int32_t> in32L(frames), in32R(frames), out32L(frames), out32R(frames);
+    std::vector<StkFloat> inL(frames), inR(frames), refL(frames), refR(frames), left(frames), right(frames);
+    FixedError worst[2] = { { -300.0, -300.0 }, { -300.0, -300.0 } };
+    std::ostringstream firstFailure;
+    int failures = 0;
+    for (int l = 0; l < 2; l++) {
+        for (int tone = 0; tone < 2; tone++) {
+            // the same Q15 samples go to every reverb
+            for (size_t t = 0; t < frames; t++) {
+                StkFloat a, b;
+                if (tone) {
+                    bool on = t % (size_t) Stk::sampleRate() < frames / 20;
+                    a = on ? std::sin(t * 0.01) : 0.0;
+                    b = on ? std::sin(t * 0.013) : 0.0;
+                }
+                else {
+                    a = 2.0 * noise();
+                    b = 2.0 * noise();
+                }
+                in16L[t] = (int16_t) std::floor(a * levels[l] * 32767.0 + 0.5);
+                in16R[t] = (int16_t) std::floor(b * levels[l] * 32767.0 + 0.5);
+                in32L[t] = in16L[t] * 65536;
+                in32R[t] = in16R[t] * 65536;
+                inL[t] = in16L[t] / 32768.0;
+                inR[t] = in16R[t] / 32768.0;
+            }
+
+            for (int r = 0; r < 3; r++) {
+                for (int d = 0; d < 2; d++) {
+                    for (int m = 0; m < 2; m++) {
+                        FreeVerb::Parameters parameters;
+                        parameters.roomSize = rooms[r];
+                        parameters.damp = damps[d];
+                        parameters.mix = mixes[m];
+                        FreeVerb reference;
+                        FreeVerbFixed q15, q31;
+                        reference.setParameters(parameters);
+                        q15.setParameters(parameters);
+                        q31.setParameters(parameters);
+                        reference.process(&inL[0], &inR[0], &refL[0], &refR[0], frames);
+                        q15.process(&in16L[0], &in16R[0], &out16L[0], &out16R[0], frames);
+                        q31.process(&in32L[0], &in32R[0], &out32L[0], &out32R[0], frames);
+
+                        FixedError error[2];
+                        for (size_t t = 0; t < frames; t++) {
+                            left[t] = out16L[t] / 32768.0;
+                            right[t] = out16R[t] / 32768.0;
+                        }
+                        error[0] = fixedError(refL, refR, left, right);
+                        for (size_t t = 0; t < frames; t++) {
+                            left[t] = out32L[t] / 2147483648.0;
+                            right[t] = out32R[t] / 2147483648.0;
+                        }
+                        error[1] = fixedError(refL, refR, left, right);
+
+                        const StkFloat rmsBound = (rooms[r] <= 0.5) ? maxSmallRoomRms : maxRms;
+                        for (int q = 0; q < 2; q++) {
+                            worst[q].rms = std::max(worst[q].rms, error[q].rms);
+                            worst[q].peak = std::max(worst[q].peak, error[q].peak);
+                            if (error[q].rms >= rmsBound || error[q].peak >= maxPeak) {
+                                if (failures++ == 0) {
+                                    firstFailure << std::setprecision(3) << (q ? "q31" : "q15")
+                                                 << (tone ? " tone" : " noise") << " at " << levels[l]
+                                                 << ", room " << rooms[r] << ", damp " << damps[d] << ", mix "
+                                                 << mixes[m] << ": " << error[q].rms << " dB rms, "
+                                                 << error[q].peak << " dB peak";
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    std::ostringstream detail;
+    detail << std::setprecision(3) << "worst q15 " << worst[0].rms << " dB rms, " << worst[0].peak
+           << " dB peak, q31 " << worst[1].rms << " dB rms, " << worst[1].peak << " dB peak";
+    if (failures) {
+        detail << "; " << failures << " cases over the bound, the first " << firstFailure.str();
+    }
+    return report("fixed", failures == 0, detail.str());
+}
+
+// a reverb from a pool starts as a new one does, whatever its last user
+// did to it, and a pool shared by several threads never hands out a
+// reverb twice or loses one
+static bool checkPool() {
+    std::vector<float> input((size_t) Stk::sampleRate());
+    for (size_t i = 0; i < input.size(); i++) {
+        input[i] = (float) noise();
+    }
+    std::vector<float> left(input.size()), right(input.size()), freshL(input.size()), freshR(input.size());
+    std::ostringstream detail;
+
+    // the last user changes everything acquire() resets
+    FreeVerbFloatPool single(1);
+    FreeVerbFloat *used = single.acquire();
+    FreeVerbFloat::Parameters changed;
+    changed.mix = 1.0;
+    changed.roomSize = 1.0;
+    changed.damp = 0.0;
+    changed.width = 0.3;
+    used->setParameters(changed);
+    used->setSmoothing(0.3);
+    used->setBypassLevel(1e-4);
+    used->setWetOnly(true);
+    used->process(&input[0], NULL, &left[0], &right[0], input.size());
+
+    // and leaves it frozen, holding its tail
+    used->setMode(true);
+    used->process(&input[0], NULL, &left[0], &right[0], input.size());
+    single.release(used);
+
+    FreeVerbFloat *reused = single.acquire();
+    FreeVerbFloat fresh;
+    FreeVerbFloat::Parameters parameters = reused->getParameters(), defaults = fresh.getParameters();
+    if (reused != used || single.acquire() != NULL) {
+        detail << "a pool of one handed out more than one reverb";
+    }
+    else if (parameters.mix != defaults.mix || parameters.roomSize != defaults.roomSize ||
+             parameters.damp != defaults.damp || parameters.width != defaults.width ||
+             parameters.frozen != defaults.frozen) {
+        detail << "acquire() kept the last user's parameters";
+    }
+    else if (reused->getClipCount(0) || reused->getClipCount(1)) {
+        detail << "acquire() kept the last user's clip counts";
+    }
+    else {
+        reused->process(&input[0], NULL, &left[0], &right[0], input.size());
+        fresh.process(&input[0], NULL, &freshL[0], &freshR[0], input.size());
+        for (size_t t = 0; t < input.size(); t++) {
+            if (left[t] != freshL[t] || right[t] != freshR[t]) {
+                detail << "a reacquired reverb differs from a new one from frame " << t;
+                break;
+            }
+        }
+    }
+    single.release(reused);
+
+    // threads taking and giving back reverbs, each marking the ones it holds,
+    // with fewer reverbs than threads so that they contend for them
+    const unsigned int size = 3, threads = 4, rounds = 2000;
+    FreeVerbFloatPool pool(size);
+    std::vector<std::atomic<int> > holders(size);
+    std::vector<FreeVerbFloat*> all(size + 1);
+    for (unsigned int i = 0; i < size; i++) {
+        all[i] = pool.acquire();
+        holders[i].store(0);
+    }
+    for (unsigned int i = 0; i < size; i++) {
+        pool.release(all[i]);
+    }
+    FreeVerbFloat *first = *std::min_element(all.begin(), all.begin() + size);
+    std::atomic<int> shared(0), lost(0);
+    std::atomic<unsigned int> ready(0);
+
+    std::vector<std::thread> workers;
+    for (unsigned int w = 0; w < threads; w++) {
+        workers.push_back(std::thread([&]() {
+            float frame[16] = { 0.0f }, outL[16], outR[16];
+
+            // start together
+            ready++;
+            while (ready.load() < threads) {
+                std::this_thread::yield();
+            }
+
+            for (unsigned int r = 0; r < rounds; r++) {
+                FreeVerbFloat *reverb = pool.acquire();
+                if (!reverb) {
+                    // every reverb is out with the other threads
+                    std::this_thread::yield();
+                    continue;
+                }
+                unsigned int i = (unsigned int) (reverb - first);
+                if (i >= size) {
+                    lost++;
+                    continue;
+                }
+                if (holders[i].exchange(1)) {
+                    shared++;
+                }
+                reverb->process(frame, NULL, outL, outR, 16);
+
+                // let the others run while this one is out, even on one core
+                std::this_thread::yield();
+                holders[i].store(0);
+                pool.release(reverb);
+            }
+        }));
+    }
+    for (unsigned int w = 0; w < threads; w++) {
+        workers[w].join();
+    }
+
+    // every reverb is back, once
+    for (unsigned int i = 0; i <= size; i++) {
+        all[i] = pool.acquire();
+    }
+    std::sort(all.begin(), all.begin() + size);
+    bool complete = all[size] == NULL && all[0] != NULL;
+    for (unsigned int i = 1; i < size && complete; i++) {
+        complete = all[i] != all[i - 1];
+    }
+    if (detail.str().empty()) {
+        if (shared) {
+            detail << "a reverb was handed to two threads at once, " << shared << " times";
+        }
+        else if (lost) {
+            detail << "acquire() returned a reverb outside the pool " << lost << " times";
+        }
+        else if (!complete) {
+            detail << "the pool did not get back every reverb once after " << threads << " threads";
+        }
+    }
+    return report("pool", detail.str().empty(), detail.str());
+}
+
+// every check, failing if any does
+static int runChecks() {
+    bool passed = true;
+    passed &= checkClear();
+    passed &= checkBank();
+    passed &= checkFixed();
+    passed &= checkPool();
+    return passed ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+    bool denormals = false;
+    bool multichannel = false;
+    unsigned int bankVoices = 0;
+    bool check = false;
+    bool quick = false;
+    StkFloat seconds = 1.0;
+    size_t block = 256;
+    StkFloat tail = 120.0;
+    StkFloat window = 15.0;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "-denormals") == 0) {
+            denormals = true;
+        }
+        else if (std::strcmp(argv[i], "-multichannel") == 0) {
+            multichannel = true;
+        }
+        else if (std::strcmp(argv[i], "-bank") == 0 && i + 1 < argc) {
+            bankVoices = std::max(std::atoi(argv[++i]), 1);
+        }
+        else if (std::strcmp(argv[i], "-check") == 0) {
+            check = true;
+        }
+        else if (std::strcmp(argv[i], "-quick") == 0) {
+            quick = true;
+        }
+        else if (std::strcmp(argv[i], "-seconds") == 0 && i + 1 < argc) {
+            seconds = std::max(std::atof(argv[++i]), 0.01);
+        }
+        else if (std::strcmp(argv[i], "-block") == 0 && i + 1 < argc) {
+            block = std::max(std::atoi(argv[++i]), 1);
+        }
+        else if (std::strcmp(argv[i], "-tail") == 0 && i + 1 < argc) {
+            tail = std::atof(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "-window") == 0 && i + 1 < argc) {
+            window = std::atof(argv[++i]);
+        }
+        else {
+            usage(argv[0]);
+        }
+    }
+
+    if (denormals) {
+        return runDenormals(block, tail, window);
+    }
+    if (multichannel) {
+        return runMultichannel(block);
+    }
+    if (bankVoices) {
+        return runBank(bankVoices, block);
+    }
+    if (check) {
+        return runChecks();
+    }
+    return runSuite(seconds, quick);
+}
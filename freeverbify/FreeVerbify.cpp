@@ -6,81 +6,709 @@
  */
 
 #include <iostream>
+#include <sstream>
+#include <fstream>
 #include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <dirent.h>
+#include <sys/stat.h>
 
+#include "FileRead.h"
 #include "FileWvIn.h"
 #include "FileWvOut.h"
 #include "../FreeVerb.h"
 
 using namespace stk;
 
-int main(int argc, char *argv[]) {
-    FileWvIn input;
+typedef std::chrono::steady_clock Clock;
+
+// one input file of a batch and where its output goes
+struct Job {
+    std::string input;
+    std::string output;
+};
+
+// what rendering one file did, for the throughput report
+struct Result {
+    bool ok;
+    unsigned long frames;
+    double seconds;
+    std::string error;
+};
+
+static void usage(const char *program) {
+    std::cout << "usage: " << program << " [-tail seconds] [-split threads [-check]] filein fileout" << std::endl;
+    std::cout << "  where 'filein' is an input soundfile to process and 'fileout' is where to write the output soundfile" << std::endl;
+    std::cout << "  -split renders segments of the file on that many threads and overlap-adds them," << std::endl;
+    std::cout << "  -check also renders serially and reports the largest difference" << std::endl;
+    std::cout << "   or: " << program << " -batch [-j threads] [-tail seconds] source outdir" << std::endl;
+    std::cout << "  where 'source' is a directory of soundfiles or a manifest listing one input soundfile per line," << std::endl;
+    std::cout << "  'outdir' is where the outputs are written, under the input names, and 'threads' defaults to the number of cores" << std::endl;
+    std::cout << "  -tail renders that many seconds of reverb tail past the end of each input" << std::endl;
+    exit(0);
+}
+
+static void setParameters(FreeVerb &fv) {
+    FreeVerb::Parameters parameters;
+    parameters.damp = 0.20;
+    parameters.width = 0.5;
+    parameters.roomSize = 0.75;
+    parameters.mix = 0.75;
+    fv.setParameters(parameters);
+}
+
+// frames read, processed and written at a time
+static const unsigned int chunkFrames = 8192;
+
+// reads an input file chunk by chunk on its own thread, one chunk ahead of the caller
+class ChunkReader {
+    public:
+        ChunkReader(FileWvIn &input, unsigned int frames)
+            : input_(input), remaining_(input.getSize()), next_(0), stop_(false) {
+            for (int i = 0; i < 2; i++) {
+                buffers_[i].resize(frames, input.channelsOut());
+                ready_[i] = false;
+            }
+            thread_ = std::thread(&ChunkReader::run, this);
+        }
+
+        ~ChunkReader() {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            changed_.notify_all();
+            thread_.join();
+        }
+
+        //! returns the next chunk, valid until the following call, or NULL at the end of the file
+        StkFrames* next() {
+            std::unique_lock<std::mutex> lock(mutex_);
+
+            // the chunk handed out last time can be refilled now
+            if (next_ > 0) {
+                ready_[(next_ - 1) % 2] = false;
+                changed_.notify_all();
+            }
+
+            StkFrames &chunk = buffers_[next_ % 2];
+            changed_.wait(lock, [&]() { return ready_[next_ % 2] || !error_.empty(); });
+            if (!ready_[next_ % 2]) {
+                throw StkError(error_);
+            }
+            if (chunk.frames() == 0) {
+                return NULL;
+            }
+
+            next_++;
+            return &chunk;
+        }
+
+    protected:
+        void run() {
+            for (size_t i = 0; ; i++) {
+                StkFrames &chunk = buffers_[i % 2];
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    changed_.wait(lock, [&]() { return !ready_[i % 2] || stop_; });
+                    if (stop_) {
+                        return;
+                    }
+                }
+
+                // the last chunk is cut short, and an empty one marks the end
+                unsigned long frames = std::min(remaining_, (unsigned long) chunk.frames());
+                if (frames < chunk.frames()) {
+                    chunk.resize(frames, chunk.channels());
+                }
+                try {
+                    if (frames > 0) {
+                        input_.tick(chunk);
+                    }
+                }
+                catch (StkError &error) {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    error_ = error.getMessage();
+                    changed_.notify_all();
+                    return;
+                }
+                remaining_ -= frames;
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    ready_[i % 2] = true;
+                }
+                changed_.notify_all();
+
+                if (frames == 0) {
+                    return;
+                }
+            }
+        }
+
+        FileWvIn &input_;
+        unsigned long remaining_;
+        StkFrames buffers_[2];
+        bool ready_[2];
+        size_t next_;
+        bool stop_;
+        std::string error_;
+        std::mutex mutex_;
+        std::condition_variable changed_;
+        std::thread thread_;
+};
+
+// apply fv to one soundfile, and tail seconds of silence after it,
+// returns the number of frames rendered
+static unsigned long renderFile(FreeVerb &fv, const std::string &fileIn, const std::string &fileOut, StkFloat tail) {
+    // keep no more than one chunk of the file in memory
+    FileWvIn input(chunkFrames, chunkFrames);
     FileWvOut output;
 
-    if (argc != 3) {
-        std::cout << "usage: " << argv[0] << " filein fileout" << std::endl;
-        std::cout << "  where 'filein' is an input soundfile to process and 'fileout' is where to write the output soundfile" << std::endl;
-        exit(0);
+    input.openFile(fileIn);
+    input.setRate(1.0);
+    if (input.getFileRate() != Stk::sampleRate()) {
+        std::ostringstream error;
+        error << "sample rate " << input.getFileRate() << " differs from " << Stk::sampleRate();
+        input.closeFile();
+        throw StkError(error.str());
     }
 
-    // Load the input sound file
     try {
-        input.openFile(argv[1]);
+        output.openFile(fileOut, input.channelsOut(), FileWrite::FILE_AIF, Stk::STK_SINT16);
     }
     catch (StkError &) {
-        exit(0);
+        input.closeFile();
+        throw;
     }
 
-    // Set global sample rate before creating class instances
-    Stk::setSampleRate(input.getFileRate());
-    input.setRate(1.0);
-
-    // Open an output file for writing
+    // using STK frames with seperate in and outs, a chunk at a time
+    // while the next chunk is read in the background
+    unsigned long frames = 0;
+    StkFrames oFrames(chunkFrames, input.channelsOut());
     try {
-        output.openFile(argv[2], input.channelsOut(), FileWrite::FILE_AIF, Stk::STK_SINT16);
+        ChunkReader reader(input, chunkFrames);
+        while (StkFrames *iFrames = reader.next()) {
+            if (iFrames->frames() != oFrames.frames()) {
+                oFrames.resize(iFrames->frames(), iFrames->channels());
+            }
+            output.tick(fv.tick(*iFrames, oFrames));
+            frames += iFrames->frames();
+        }
+
+        // let the reverb ring out on silence
+        unsigned long tailFrames = (unsigned long) (tail * Stk::sampleRate() + 0.5);
+        StkFrames silence(chunkFrames, input.channelsOut());
+        while (tailFrames > 0) {
+            unsigned long n = std::min(tailFrames, (unsigned long) chunkFrames);
+            if (n != silence.frames()) {
+                silence.resize(n, input.channelsOut(), 0.0);
+            }
+            oFrames.resize(n, input.channelsOut());
+            output.tick(fv.tick(silence, oFrames));
+            frames += n;
+            tailFrames -= n;
+        }
     }
     catch (StkError &) {
+        // file pointer cleanup
         input.closeFile();
+        output.closeFile();
+        throw;
+    }
+
+    input.closeFile();
+    output.closeFile();
+
+    return frames;
+}
+
+// level below which a segment's reverb tail is cut off in a split render
+static const StkFloat splitTailLevel = 1e-9;
+
+// largest difference from a serial render accepted by -check, well below
+// the resolution of the 16 bit output
+static const StkFloat splitTolerance = 1e-6;
+
+// segments rendered per thread are this many tail lengths long
+static const unsigned int splitSegmentTails = 4;
+
+// read frames of file from start on, stopping at end and zero padding past it
+static void readFrames(FileRead &file, unsigned long start, unsigned long end, StkFrames &frames) {
+    end = std::min(end, file.fileSize());
+    unsigned long n = (start < end) ? std::min(end - start, (unsigned long) frames.frames()) : 0;
+
+    if (n == frames.frames()) {
+        file.read(frames, start);
+        return;
+    }
+
+    unsigned int channels = frames.channels();
+    for (size_t i = 0; i < frames.size(); i++) {
+        frames[i] = 0.0;
+    }
+    if (n > 0) {
+        StkFrames part(n, channels);
+        file.read(part, start);
+        for (size_t i = 0; i < part.size(); i++) {
+            frames[i] = part[i];
+        }
+    }
+}
+
+// apply fv to one soundfile on a number of threads
+/*
+  Outside freeze mode the wet signal is linear in the input, so the file is
+  cut into segments that are each rendered wet-only from a cleared reverb,
+  with their tails cut off once they decay below splitTailLevel. The
+  segments are overlap-added, and the dry signal and limiter applied to the
+  sum. With maxError set, the file is also rendered serially and the
+  largest difference between the two stored there.
+*/
+static unsigned long renderSplit(FreeVerb &fv, const std::string &fileIn, const std::string &fileOut,
+                                 StkFloat tail, unsigned int threads, StkFloat *maxError) {
+    // a frozen reverb never decays
+    if (fv.getMode()) {
+        return renderFile(fv, fileIn, fileOut, tail);
+    }
+
+    FileRead file(fileIn);
+    if (file.fileRate() != Stk::sampleRate()) {
+        std::ostringstream error;
+        error << "sample rate " << file.fileRate() << " differs from " << Stk::sampleRate();
+        throw StkError(error.str());
+    }
+
+    unsigned int channels = file.channels();
+    unsigned long inFrames = file.fileSize();
+    unsigned long outFrames = inFrames + (unsigned long) (tail * Stk::sampleRate() + 0.5);
+
+    FileWvOut output;
+    output.openFile(fileOut, channels, FileWrite::FILE_AIF, Stk::STK_SINT16);
+
+    // each worker renders one segment per round, adding it into acc, and
+    // its tail past the segment into its own buffer
+    unsigned long tailLength = fv.tailFrames(splitTailLevel);
+    unsigned long segment = std::max(splitSegmentTails * tailLength, (unsigned long) chunkFrames);
+    unsigned long round = segment * threads;
+
+    std::vector<FreeVerb> reverbs(threads, fv);
+    std::vector<StkFrames> tails(threads, StkFrames(tailLength, channels));
+    StkFrames acc(round + tailLength, channels);
+    for (unsigned int w = 0; w < threads; w++) {
+        reverbs[w].setWetOnly(true);
+    }
+
+    FreeVerb serial(fv);
+    serial.clear();
+
+    std::string workerError;
+    std::mutex errorMutex;
+    if (maxError) {
+        *maxError = 0.0;
+    }
+
+    for (unsigned long start = 0; start < outFrames; start += round) {
+        std::vector<std::thread> workers;
+        for (unsigned int w = 0; w < threads; w++) {
+            workers.push_back(std::thread([&, w]() {
+                FreeVerb &reverb = reverbs[w];
+                StkFrames &tailFrames = tails[w];
+                for (size_t i = 0; i < tailFrames.size(); i++) {
+                    tailFrames[i] = 0.0;
+                }
+
+                unsigned long begin = start + w * segment;
+                if (begin >= inFrames) {
+                    return;
+                }
+                unsigned long end = std::min(begin + segment, inFrames);
+
+                reverb.clear();
+                FileRead segmentFile;
+                try {
+                    segmentFile.open(fileIn);
+                }
+                catch (StkError &error) {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    workerError = error.getMessage();
+                    return;
+                }
+
+                StkFrames iFrames(chunkFrames, channels);
+                StkFrames oFrames(chunkFrames, channels);
+                for (unsigned long pos = begin; pos < end + tailLength; pos += iFrames.frames()) {
+                    unsigned long n = std::min((unsigned long) chunkFrames, end + tailLength - pos);
+                    if (n != iFrames.frames()) {
+                        iFrames.resize(n, channels);
+                        oFrames.resize(n, channels);
+                    }
+                    try {
+                        readFrames(segmentFile, pos, end, iFrames);
+                    }
+                    catch (StkError &error) {
+                        std::lock_guard<std::mutex> lock(errorMutex);
+                        workerError = error.getMessage();
+                        return;
+                    }
+                    reverb.tick(iFrames, oFrames);
+
+                    // frames up to the next segment are this worker's own, the rest is tail
+                    for (unsigned long t = 0; t < n; t++) {
+                        unsigned long at = pos + t;
+                        StkFloat *dst = (at < begin + segment) ? &acc[(at - start) * channels]
+                                                               : &tailFrames[(at - begin - segment) * channels];
+                        for (unsigned int c = 0; c < channels; c++) {
+                            dst[c] += oFrames[t * channels + c];
+                        }
+                    }
+                }
+            }));
+        }
+        for (unsigned int w = 0; w < threads; w++) {
+            workers[w].join();
+        }
+        if (!workerError.empty()) {
+            output.closeFile();
+            throw StkError(workerError);
+        }
+
+        // overlap-add the tails onto the following segments
+        for (unsigned int w = 0; w < threads; w++) {
+            StkFloat *dst = &acc[(w + 1) * segment * channels];
+            for (size_t i = 0; i < tails[w].size(); i++) {
+                dst[i] += tails[w][i];
+            }
+        }
+
+        // add the dry signal and limit, compare with the serial render, write out
+        unsigned long length = std::min(round, outFrames - start);
+        StkFrames iFrames(chunkFrames, channels);
+        StkFrames oFrames(chunkFrames, channels);
+        StkFrames sFrames(chunkFrames, channels);
+        for (unsigned long pos = 0; pos < length; pos += iFrames.frames()) {
+            unsigned long n = std::min((unsigned long) chunkFrames, length - pos);
+            if (n != iFrames.frames()) {
+                iFrames.resize(n, channels);
+                oFrames.resize(n, channels);
+                sFrames.resize(n, channels);
+            }
+            readFrames(file, start + pos, inFrames, iFrames);
+            for (size_t i = 0; i < oFrames.size(); i++) {
+                oFrames[i] = acc[pos * channels + i];
+            }
+            fv.mixDry(iFrames, oFrames);
+
+            if (maxError) {
+                serial.tick(iFrames, sFrames);
+                for (size_t i = 0; i < oFrames.size(); i++) {
+                    *maxError = std::max(*maxError, (StkFloat) fabs(oFrames[i] - sFrames[i]));
+                }
+            }
+
+            output.tick(oFrames);
+        }
+
+        // carry the tails that reach into the next round
+        for (size_t i = 0; i < acc.size(); i++) {
+            acc[i] = (i < tailLength * channels) ? acc[round * channels + i] : 0.0;
+        }
+    }
+
+    output.closeFile();
+
+    return outFrames;
+}
+
+static bool isSoundFile(const std::string &name) {
+    static const char *extensions[] = { ".wav", ".aif", ".aiff", ".snd", ".au", ".mat" };
+    std::string::size_type dot = name.rfind('.');
+    if (dot == std::string::npos) {
+        return false;
+    }
+
+    std::string extension = name.substr(dot);
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    for (unsigned int i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++) {
+        if (extension == extensions[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// input paths from a directory of soundfiles or a manifest with one path per line
+static std::vector<std::string> listInputs(const std::string &source) {
+    std::vector<std::string> inputs;
+
+    struct stat info;
+    if (stat(source.c_str(), &info) == 0 && S_ISDIR(info.st_mode)) {
+        DIR *dir = opendir(source.c_str());
+        if (dir) {
+            while (struct dirent *entry = readdir(dir)) {
+                std::string name = entry->d_name;
+                if (name[0] != '.' && isSoundFile(name)) {
+                    inputs.push_back(source + "/" + name);
+                }
+            }
+            closedir(dir);
+        }
+        std::sort(inputs.begin(), inputs.end());
+    }
+    else {
+        std::ifstream manifest(source.c_str());
+        std::string line;
+        while (std::getline(manifest, line)) {
+            // trim surrounding whitespace, skip blank lines and # comments
+            std::string::size_type first = line.find_first_not_of(" \t\r");
+            if (first == std::string::npos || line[first] == '#') {
+                continue;
+            }
+            std::string::size_type last = line.find_last_not_of(" \t\r");
+            inputs.push_back(line.substr(first, last - first + 1));
+        }
+    }
+
+    return inputs;
+}
+
+// output path for an input: its base name in outdir, as an AIFF file
+static std::string outputPath(const std::string &outDir, const std::string &fileIn) {
+    std::string name = fileIn;
+    std::string::size_type slash = name.rfind('/');
+    if (slash != std::string::npos) {
+        name = name.substr(slash + 1);
+    }
+    std::string::size_type dot = name.rfind('.');
+    if (dot != std::string::npos && dot > 0) {
+        name = name.substr(0, dot);
+    }
+    return outDir + "/" + name + ".aif";
+}
+
+// true when both paths name the same existing file
+static bool sameFile(const std::string &a, const std::string &b) {
+    struct stat infoA, infoB;
+    return stat(a.c_str(), &infoA) == 0 && stat(b.c_str(), &infoB) == 0
+        && infoA.st_dev == infoB.st_dev && infoA.st_ino == infoB.st_ino;
+}
+
+static int runBatch(const std::string &source, const std::string &outDir, unsigned int threads, StkFloat tail) {
+    std::vector<std::string> inputs = listInputs(source);
+    if (inputs.empty()) {
+        std::cout << "no input soundfiles found in " << source << std::endl;
+        return 1;
+    }
+
+    std::vector<Job> jobs(inputs.size());
+    for (size_t i = 0; i < inputs.size(); i++) {
+        jobs[i].input = inputs[i];
+        jobs[i].output = outputPath(outDir, inputs[i]);
+    }
+
+    // workers writing one file at once would corrupt it, and an input
+    // overwritten while it is read would be lost, so neither may start
+    std::vector<size_t> byOutput(jobs.size());
+    for (size_t i = 0; i < jobs.size(); i++) {
+        byOutput[i] = i;
+    }
+    std::sort(byOutput.begin(), byOutput.end(), [&jobs](size_t a, size_t b) {
+        return jobs[a].output < jobs[b].output;
+    });
+    bool clash = false;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        const Job &job = jobs[byOutput[i]];
+        if (i > 0 && job.output == jobs[byOutput[i - 1]].output) {
+            std::cout << jobs[byOutput[i - 1]].input << " and " << job.input
+                      << " would both be written to " << job.output << std::endl;
+            clash = true;
+        }
+        if (sameFile(job.input, job.output)) {
+            std::cout << job.input << " would be overwritten by its own output" << std::endl;
+            clash = true;
+        }
+    }
+    if (clash) {
+        return 1;
+    }
+
+    // the sample rate is global in STK, so one rate is used for the whole batch,
+    // taken from the first file; files at other rates are reported as failed
+    try {
+        FileRead first(jobs[0].input);
+        Stk::setSampleRate(first.fileRate());
+    }
+    catch (StkError &) {
+        std::cout << "cannot read " << jobs[0].input << std::endl;
+        return 1;
+    }
+
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    threads = std::min(threads, (unsigned int) jobs.size());
+
+    // one reverb per worker, configured once and copied, and cleared between files
+    FreeVerb prototype;
+    setParameters(prototype);
+    std::vector<FreeVerb> reverbs(threads, prototype);
+
+    std::vector<Result> results(jobs.size());
+    std::atomic<size_t> next(0);
+    std::mutex reportMutex;
+
+    Clock::time_point batchStart = Clock::now();
+
+    std::vector<std::thread> workers;
+    for (unsigned int w = 0; w < threads; w++) {
+        workers.push_back(std::thread([&, w]() {
+            FreeVerb &fv = reverbs[w];
+            for (size_t j = next++; j < jobs.size(); j = next++) {
+                Result &result = results[j];
+                Clock::time_point start = Clock::now();
+                fv.clear();
+                try {
+                    result.frames = renderFile(fv, jobs[j].input, jobs[j].output, tail);
+                    result.ok = true;
+                }
+                catch (StkError &error) {
+                    result.frames = 0;
+                    result.ok = false;
+                    result.error = error.getMessage();
+                }
+                result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+                std::ostringstream line;
+                if (result.ok) {
+                    double audio = result.frames / Stk::sampleRate();
+                    line << jobs[j].input << " -> " << jobs[j].output << ": "
+                         << result.frames << " frames in " << result.seconds << " s, "
+                         << audio / result.seconds << "x realtime";
+                }
+                else {
+                    line << jobs[j].input << ": failed";
+                    if (!result.error.empty()) {
+                        line << " (" << result.error << ")";
+                    }
+                }
+
+                std::lock_guard<std::mutex> lock(reportMutex);
+                std::cout << line.str() << std::endl;
+            }
+        }));
+    }
+    for (unsigned int w = 0; w < threads; w++) {
+        workers[w].join();
+    }
+
+    double wall = std::chrono::duration<double>(Clock::now() - batchStart).count();
+    unsigned long frames = 0;
+    size_t failed = 0;
+    for (size_t j = 0; j < results.size(); j++) {
+        frames += results[j].frames;
+        failed += !results[j].ok;
+    }
+    double audio = frames / Stk::sampleRate();
+
+    std::cout << std::endl;
+    std::cout << jobs.size() - failed << " of " << jobs.size() << " files rendered with "
+              << threads << " threads in " << wall << " s" << std::endl;
+    std::cout << frames << " frames, " << audio << " s of audio, "
+              << frames / wall << " frames/s, " << audio / wall << "x realtime" << std::endl;
+
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    bool batch = false;
+    bool check = false;
+    unsigned int threads = 0;
+    unsigned int split = 0;
+    StkFloat tail = 0.0;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "-batch") == 0) {
+            batch = true;
+        }
+        else if (std::strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            threads = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "-split") == 0 && i + 1 < argc) {
+            split = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "-check") == 0) {
+            check = true;
+        }
+        else if (std::strcmp(argv[i], "-tail") == 0 && i + 1 < argc) {
+            tail = std::max(std::atof(argv[++i]), 0.0);
+        }
+        else if (argv[i][0] == '-') {
+            usage(argv[0]);
+        }
+        else {
+            files.push_back(argv[i]);
+        }
+    }
+    if (files.size() != 2) {
+        usage(argv[0]);
+    }
+
+    if (batch) {
+        return runBatch(files[0], files[1], threads, tail);
+    }
+
+    if (sameFile(files[0], files[1])) {
+        std::cout << files[0] << " would be overwritten by its own output" << std::endl;
+        return 1;
+    }
+
+    // Set global sample rate before creating class instances
+    try {
+        FileRead input(files[0]);
+        Stk::setSampleRate(input.fileRate());
+    }
+    catch (StkError &) {
         exit(0);
     }
 
     FreeVerb fv = FreeVerb();
-    fv.setDamp(0.20);
-    fv.setWidth(0.5);
-    fv.setRoomSize(0.75);
-    fv.setMix(0.75);
-
-    /* single sample computation */
-    /*
-    for (unsigned int i = 0; i < input.getSize(); i++) {
+    setParameters(fv);
+
+    if (split == 0) {
         try {
-            output.tick(fv.tick(input.tick()));
+            renderFile(fv, files[0], files[1], tail);
         }
         catch (StkError &) {
-            break; // file pointer cleanup
+            exit(0);
         }
-    }*/
-    
-    /* use STK frames with replacement
-    StkFrames frames(input.getSize(), input.channelsOut());
-    try {
-        output.tick(fv.tick(input.tick(frames)));
+        return 0;
     }
-    catch (StkError &) {
-        // file pointer cleanup
-    }*/
 
-    // using STK frames with seperate in and outs
-    StkFrames iFrames(input.getSize(), input.channelsOut());
-    StkFrames oFrames(input.getSize(), input.channelsOut());
+    StkFloat maxError = 0.0;
+    Clock::time_point start = Clock::now();
     try {
-        output.tick(fv.tick(input.tick(iFrames), oFrames));
+        renderSplit(fv, files[0], files[1], tail, split, check ? &maxError : NULL);
     }
     catch (StkError &) {
-        // file pointer cleanup
+        exit(0);
     }
 
-    input.closeFile();
-    output.closeFile();
+    if (check) {
+        std::cout << "rendered on " << split << " threads in "
+                  << std::chrono::duration<double>(Clock::now() - start).count() << " s, "
+                  << "largest difference from a serial render: " << maxError << std::endl;
+        if (maxError > splitTolerance) {
+            std::cout << "exceeds the tolerance of " << splitTolerance << std::endl;
+            return 1;
+        }
+    }
 }